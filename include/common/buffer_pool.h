@@ -0,0 +1,281 @@
+#ifndef __NAIAD_BUFFER_POOL_H__
+#define __NAIAD_BUFFER_POOL_H__
+
+/**
+ * @file buffer_pool.h
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 固定大小的内存块缓存池，用于网络接收
+ * @version 0.1
+ * @date 2023-07-03
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   - 所有内存块在一块连续的slab中预先分配，空闲块用单链表串起来
+ *   - 可以使用大页(MAP_HUGETLB)，系统不支持时退回普通页并建议内核使用透明大页
+ *   - 缓存池用完时从堆上分配(计为miss)，释放时直接归还给堆
+ *   - 分配和释放可以在不同线程中调用
+ *   - 每块内存带引用计数，可以由SharedBuffer在多个对象间共享，最后一个引用释放时归还
+ *   - 缓存池本身也有引用计数，还有块未归还时，即使所有者已释放，缓存池也会保留到最后一块归还
+ */
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <memory>
+
+namespace naiad
+{
+namespace network
+{
+
+/**
+ * @brief 缓存池统计信息
+ *
+ */
+struct BufferPoolStatistics
+{
+    /// 每块的大小
+    std::size_t block_size;
+    /// 池中的块数量
+    std::size_t block_num;
+    /// 当前空闲的块数量
+    std::size_t free_num;
+    /// 从池中分配成功的次数
+    uint64_t hits;
+    /// 池已用完，从堆上分配的次数
+    uint64_t misses;
+    /// 是否使用了大页
+    bool huge_pages;
+};
+
+
+class BufferPool
+{
+public:
+    /// 释放所有者的引用，缓存池在最后一块内存归还后才销毁
+    struct Deleter
+    {
+        void operator()(BufferPool *pool) const
+        {
+            pool->unref();
+        }
+    };
+
+    typedef std::unique_ptr<BufferPool, Deleter> Ptr;
+
+    /**
+     * @brief 创建一个缓存池，此时不分配内存
+     *
+     * @param block_size 每块的大小
+     * @param block_num 块数量
+     * @param huge_pages 是否使用大页
+     * @return Ptr
+     */
+    static Ptr create(std::size_t block_size = 64 * 1024, std::size_t block_num = 8, bool huge_pages = false)
+    {
+        return Ptr(new BufferPool(block_size, block_num, huge_pages));
+    }
+
+    // 禁止复制构造
+    BufferPool(const BufferPool &) = delete;
+    BufferPool & operator=(const BufferPool &) = delete;
+
+    /**
+     * @brief 分配一块内存，第一次调用时分配slab
+     *
+     * @return uint8_t* 大小为block_size()，引用计数为1，失败时返回nullptr
+     */
+    uint8_t * allocate();
+
+    /**
+     * @brief 增加allocate()分配的内存的引用计数
+     *
+     * @param data
+     */
+    static void retain(uint8_t *data);
+
+    /**
+     * @brief 减少allocate()分配的内存的引用计数，为0时归还
+     *
+     * @param data
+     */
+    static void release(uint8_t *data);
+
+    /**
+     * @brief 返回allocate()分配的内存的引用计数
+     *
+     * @param data
+     * @return int
+     */
+    static int use_count(uint8_t const *data);
+
+    /// 返回每块的大小
+    std::size_t block_size() const
+    {
+        return block_size_;
+    }
+
+    /**
+     * @brief 返回统计信息
+     *
+     * @return BufferPoolStatistics
+     */
+    BufferPoolStatistics get_statistics();
+
+private:
+    /// 每块内存前面的头部，占一个cache line，保证数据对齐
+    struct Block
+    {
+        /// 空闲链表
+        Block *next;
+        /// 所属的缓存池，从堆上分配时为nullptr
+        BufferPool *pool;
+        /// 引用计数
+        std::atomic<int> refs;
+        char pad[64 - 2 * sizeof(void *) - sizeof(std::atomic<int>)];
+
+        uint8_t * data()
+        {
+            return reinterpret_cast<uint8_t *>(this + 1);
+        }
+
+        static Block * from_data(uint8_t const *data)
+        {
+            return reinterpret_cast<Block *>(const_cast<uint8_t *>(data)) - 1;
+        }
+    };
+
+    BufferPool(std::size_t block_size, std::size_t block_num, bool huge_pages);
+    ~BufferPool();
+
+    std::size_t block_size_;
+    std::size_t block_num_;
+    bool huge_pages_;
+    /// 实际是否使用了大页
+    bool huge_pages_used_ = false;
+
+    /// slab内存
+    void *slab_ = nullptr;
+    std::size_t slab_size_ = 0;
+    bool slab_failed_ = false;
+
+    /// 空闲链表
+    Block *free_list_ = nullptr;
+    std::size_t free_num_ = 0;
+    std::mutex mutex_;
+
+    std::atomic<uint64_t> hits_ {0};
+    std::atomic<uint64_t> misses_ {0};
+
+    /// 所有者和未归还的块各持有一个引用
+    std::atomic<std::size_t> refs_ {1};
+
+    bool setup_slab();
+    void put_back(Block *block);
+    void unref();
+};
+
+
+/**
+ * @brief 共享一块缓存池内存的引用，复制时只增加引用计数
+ *
+ */
+class SharedBuffer
+{
+public:
+    SharedBuffer() { }
+
+    ~SharedBuffer()
+    {
+        reset();
+    }
+
+    SharedBuffer(SharedBuffer const &other) : data_(other.data_)
+    {
+        if (data_)
+        {
+            BufferPool::retain(data_);
+        }
+    }
+
+    SharedBuffer(SharedBuffer &&other) : data_(other.data_)
+    {
+        other.data_ = nullptr;
+    }
+
+    SharedBuffer & operator=(SharedBuffer const &other)
+    {
+        if (this != &other)
+        {
+            reset();
+            data_ = other.data_;
+            if (data_)
+            {
+                BufferPool::retain(data_);
+            }
+        }
+
+        return *this;
+    }
+
+    SharedBuffer & operator=(SharedBuffer &&other)
+    {
+        if (this != &other)
+        {
+            reset();
+            data_ = other.data_;
+            other.data_ = nullptr;
+        }
+
+        return *this;
+    }
+
+    /**
+     * @brief 接管一块BufferPool::allocate()得到的内存，不增加引用计数
+     *
+     * @param data
+     * @return SharedBuffer
+     */
+    static SharedBuffer adopt(uint8_t *data)
+    {
+        SharedBuffer buffer;
+        buffer.data_ = data;
+        return buffer;
+    }
+
+    /// 释放引用
+    void reset()
+    {
+        if (data_)
+        {
+            BufferPool::release(data_);
+            data_ = nullptr;
+        }
+    }
+
+    uint8_t * data() const
+    {
+        return data_;
+    }
+
+    bool empty() const
+    {
+        return (data_ == nullptr);
+    }
+
+    int use_count() const
+    {
+        return data_ ? BufferPool::use_count(data_) : 0;
+    }
+
+private:
+    uint8_t *data_ = nullptr;
+};
+
+} // network
+
+} // naiad
+
+#endif // __NAIAD_BUFFER_POOL_H__
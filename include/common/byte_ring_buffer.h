@@ -0,0 +1,311 @@
+#ifndef __NAIAD_BYTE_RING_BUFFER_H__
+#define __NAIAD_BYTE_RING_BUFFER_H__
+
+/**
+ * @file byte_ring_buffer.h
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 单生产者/单消费者的无锁字节环形缓存
+ * @version 0.1
+ * @date 2023-06-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   - 只允许一个线程写入(push)，一个线程读出(pop)，两端均不加锁
+ *   - 容量固定，写满后多余的数据由调用者决定丢弃
+ *   - 读写位置的前后各填充一个cache line，不论对象的起始地址如何对齐，
+ *     两端频繁写入的字段都不会落在同一个cache line上，避免伪共享
+ *   - 使用填充而不是alignas，避免C++14下对象new时的对齐问题
+ */
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+
+namespace naiad
+{
+namespace driver
+{
+
+class ByteRingBuffer
+{
+public:
+    /// cache line 大小
+    static constexpr std::size_t CacheLineSize = 64;
+
+    /// 一段连续的缓存数据
+    struct Span
+    {
+        uint8_t const *data;
+        std::size_t size;
+    };
+
+    ByteRingBuffer() { }
+    ~ByteRingBuffer() { }
+
+    // 禁止复制构造
+    ByteRingBuffer(const ByteRingBuffer &) = delete;
+    ByteRingBuffer & operator=(const ByteRingBuffer &) = delete;
+
+    /**
+     * @brief 重新分配缓存，此时不能有读写操作
+     *
+     * @param capacity 可存放的最大字节数
+     * @return true
+     * @return false
+     */
+    bool reset(std::size_t capacity)
+    {
+        if (capacity == 0)
+        {
+            return false;
+        }
+
+        // 实际空间按2的幂分配，取位置时只需要做与运算
+        std::size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        buffer_.reset(new uint8_t[size]);
+        mask_ = size - 1;
+        capacity_ = capacity;
+
+        head_.pos.store(0, std::memory_order_relaxed);
+        tail_.pos.store(0, std::memory_order_relaxed);
+        head_.peer = 0;
+        tail_.peer = 0;
+
+        return true;
+    }
+
+    /**
+     * @brief 返回容量
+     *
+     * @return std::size_t
+     */
+    std::size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /**
+     * @brief 返回当前缓存的数据量，两端都可以调用
+     *
+     * @return std::size_t
+     */
+    std::size_t size() const
+    {
+        return head_.pos.load(std::memory_order_acquire) - tail_.pos.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 是否为空
+     *
+     * @return true
+     * @return false
+     */
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /**
+     * @brief 写入数据，只能由生产者调用
+     *
+     * @param data
+     * @param size
+     * @return std::size_t 实际写入的字节数，空间不足时只写入能放下的部分
+     */
+    std::size_t push(void const *data, std::size_t size)
+    {
+        std::size_t head = head_.pos.load(std::memory_order_relaxed);
+        std::size_t free = capacity_ - (head - head_.peer);
+
+        // 空间不足时，再去读取一次消费者的位置
+        if (free < size)
+        {
+            head_.peer = tail_.pos.load(std::memory_order_acquire);
+            free = capacity_ - (head - head_.peer);
+        }
+
+        if (size > free)
+        {
+            size = free;
+        }
+
+        if (size > 0)
+        {
+            copy_in(head, static_cast<uint8_t const *>(data), size);
+            head_.pos.store(head + size, std::memory_order_release);
+        }
+
+        return size;
+    }
+
+    /**
+     * @brief 读出数据，只能由消费者调用
+     *
+     * @param data
+     * @param size
+     * @return std::size_t 实际读出的字节数
+     */
+    std::size_t pop(void *data, std::size_t size)
+    {
+        std::size_t tail = tail_.pos.load(std::memory_order_relaxed);
+        std::size_t used = tail_.peer - tail;
+
+        if (used < size)
+        {
+            tail_.peer = head_.pos.load(std::memory_order_acquire);
+            used = tail_.peer - tail;
+        }
+
+        if (size > used)
+        {
+            size = used;
+        }
+
+        if (size > 0)
+        {
+            copy_out(tail, static_cast<uint8_t *>(data), size);
+            tail_.pos.store(tail + size, std::memory_order_release);
+        }
+
+        return size;
+    }
+
+    /**
+     * @brief 不拷贝地查看缓存中的数据，只能由消费者调用
+     *
+     * @param first 第一段连续数据
+     * @param second 第二段连续数据，数据未跨越缓存末尾时为空
+     * @return std::size_t 可查看的总字节数
+     * @note 返回的数据在consume()之前保持有效
+     */
+    std::size_t peek(Span &first, Span &second)
+    {
+        std::size_t tail = tail_.pos.load(std::memory_order_relaxed);
+        tail_.peer = head_.pos.load(std::memory_order_acquire);
+
+        std::size_t used = tail_.peer - tail;
+        std::size_t offset = tail & mask_;
+        std::size_t contiguous = mask_ + 1 - offset;
+
+        first.data = buffer_.get() + offset;
+        second.data = buffer_.get();
+
+        if (used <= contiguous)
+        {
+            first.size = used;
+            second.size = 0;
+        }
+        else
+        {
+            first.size = contiguous;
+            second.size = used - contiguous;
+        }
+
+        return used;
+    }
+
+    /**
+     * @brief 丢弃缓存头部的数据，只能由消费者调用
+     *
+     * @param size
+     * @return std::size_t 实际丢弃的字节数
+     */
+    std::size_t consume(std::size_t size)
+    {
+        std::size_t tail = tail_.pos.load(std::memory_order_relaxed);
+        std::size_t used = tail_.peer - tail;
+
+        if (used < size)
+        {
+            tail_.peer = head_.pos.load(std::memory_order_acquire);
+            used = tail_.peer - tail;
+        }
+
+        if (size > used)
+        {
+            size = used;
+        }
+
+        tail_.pos.store(tail + size, std::memory_order_release);
+
+        return size;
+    }
+
+    /**
+     * @brief 清空数据，只能由消费者调用
+     *
+     */
+    void clear()
+    {
+        tail_.peer = head_.pos.load(std::memory_order_acquire);
+        tail_.pos.store(tail_.peer, std::memory_order_release);
+    }
+
+private:
+    /// 一端的位置信息，前面填充一个cache line，与之前的字段隔开
+    struct Cursor
+    {
+        char pad[CacheLineSize];
+        /// 本端的位置
+        std::atomic<std::size_t> pos {0};
+        /// 缓存的对端位置
+        std::size_t peer = 0;
+    };
+
+    /// 写位置，由生产者更新
+    Cursor head_;
+    /// 读位置，由消费者更新
+    Cursor tail_;
+    /// 与之后的只读参数隔开
+    char pad_[CacheLineSize];
+
+    /// 只读参数，与读写位置隔开
+    std::unique_ptr<uint8_t []> buffer_;
+    std::size_t mask_ = 0;
+    std::size_t capacity_ = 0;
+
+    void copy_in(std::size_t pos, uint8_t const *data, std::size_t size)
+    {
+        std::size_t offset = pos & mask_;
+        std::size_t first = mask_ + 1 - offset;
+
+        if (first >= size)
+        {
+            ::memcpy(buffer_.get() + offset, data, size);
+        }
+        else
+        {
+            ::memcpy(buffer_.get() + offset, data, first);
+            ::memcpy(buffer_.get(), data + first, size - first);
+        }
+    }
+
+    void copy_out(std::size_t pos, uint8_t *data, std::size_t size) const
+    {
+        std::size_t offset = pos & mask_;
+        std::size_t first = mask_ + 1 - offset;
+
+        if (first >= size)
+        {
+            ::memcpy(data, buffer_.get() + offset, size);
+        }
+        else
+        {
+            ::memcpy(data, buffer_.get() + offset, first);
+            ::memcpy(data + first, buffer_.get(), size - first);
+        }
+    }
+};
+
+} // driver
+
+} // naiad
+
+#endif // __NAIAD_BYTE_RING_BUFFER_H__
@@ -0,0 +1,136 @@
+#ifndef __NAIAD_MPSC_QUEUE_H__
+#define __NAIAD_MPSC_QUEUE_H__
+
+/**
+ * @file mpsc_queue.h
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 多生产者/单消费者的无锁队列
+ * @version 0.1
+ * @date 2023-07-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   - 使用Dmitry Vyukov的MPSC链表队列，生产者只做一次exchange，不会互相等待，也不会等待消费者
+ *   - 只允许一个线程读出(pop)
+ *   - 生产者exchange之后、链接next之前，消费者会暂时看不到这个及之后的节点，
+ *     pop()返回false，生产者完成后需要再通知消费者
+ *   - 头尾之间用填充隔开，避免伪共享
+ */
+
+#include <atomic>
+#include <utility>
+
+namespace naiad
+{
+namespace network
+{
+
+template <typename T>
+class MpscQueue
+{
+public:
+    /// cache line 大小
+    static constexpr std::size_t CacheLineSize = 64;
+
+    MpscQueue()
+    {
+        // 队列中总是有一个空节点，tail_指向它
+        Node *stub = new Node;
+        head_.store(stub, std::memory_order_relaxed);
+        tail_ = stub;
+    }
+
+    ~MpscQueue()
+    {
+        clear();
+        delete tail_;
+    }
+
+    // 禁止复制构造
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue & operator=(const MpscQueue &) = delete;
+
+    /**
+     * @brief 加入一个元素，可以在任意线程中调用
+     *
+     * @param value
+     */
+    void push(T &&value)
+    {
+        Node *node = new Node(std::move(value));
+
+        Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief 取出一个元素，只能在消费者线程中调用
+     *
+     * @param value
+     * @return true
+     * @return false 队列为空
+     */
+    bool pop(T &value)
+    {
+        Node *tail = tail_;
+        Node *next = tail->next.load(std::memory_order_acquire);
+
+        if (next == nullptr)
+        {
+            return false;
+        }
+
+        // next成为新的空节点
+        value = std::move(next->value);
+        tail_ = next;
+        delete tail;
+
+        return true;
+    }
+
+    /**
+     * @brief 丢弃所有元素，只能在消费者线程中调用
+     *
+     */
+    void clear()
+    {
+        T value;
+        while (pop(value))
+        {
+        }
+    }
+
+    /**
+     * @brief 是否为空，只在消费者线程中准确
+     *
+     * @return true
+     * @return false
+     */
+    bool empty() const
+    {
+        return tail_->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node
+    {
+        Node() { }
+        explicit Node(T &&v) : value(std::move(v)) { }
+
+        std::atomic<Node *> next {nullptr};
+        T value;
+    };
+
+    /// 生产者写入的位置
+    std::atomic<Node *> head_;
+    char pad_[CacheLineSize - sizeof(std::atomic<Node *>)];
+    /// 消费者读出的位置
+    Node *tail_;
+};
+
+} // network
+
+} // naiad
+
+#endif // __NAIAD_MPSC_QUEUE_H__
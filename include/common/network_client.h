@@ -14,6 +14,7 @@
  */
 
 #include <string>
+#include <cstdint>
 #include <common/sys_time.h>
 
 
@@ -30,6 +31,8 @@ struct ClientInfo
     std::string address;
     /// 客户端端口
     int port;
+    /// 最近一次连接的id
+    uint32_t id;
     /// 是否连接
     bool connected;
     /// 连接时间
@@ -46,6 +49,8 @@ struct Host
 {
     std::string address;
     int port;
+    /// 服务端分配的连接id，非0时按id查找连接，不再比较地址
+    uint32_t id = 0;
 };
 
 
@@ -14,9 +14,12 @@
  */
 
 #include <string>
+#include <vector>
 #include <cstring>
+#include <memory>
 
 #include <common/network_client.h>
+#include <common/buffer_pool.h>
 #include <common/sys_time.h>
 //#include <common/logger.h>
 
@@ -27,24 +30,196 @@ namespace naiad
 namespace network
 {
 
+class DataFrame;
 
+/**
+ * @brief 一段待发送的数据，不持有内存
+ * 
+ */
+struct DataSegment
+{
+    void const *data;
+    int size;
+};
+
+/**
+ * @brief 只读的共享数据，复制时只增加引用计数
+ * 
+ * @note 用于发送，同一份数据可以同时挂在多个连接的uv_write上，
+ *   每个写请求持有一个引用，最后一个写请求完成时释放
+ */
+class SharedPayload
+{
+public:
+    SharedPayload() { }
+
+    /**
+     * @brief 复制一份数据
+     * 
+     * @param data 
+     * @param size 
+     * @return SharedPayload 
+     */
+    static SharedPayload copy(void const *data, int size)
+    {
+        SharedPayload payload;
+
+        if (data && (size > 0))
+        {
+            uint8_t *memory = new uint8_t [size];
+            ::memcpy(memory, data, size);
+
+            payload.holder_ = std::shared_ptr<uint8_t const>(memory, std::default_delete<uint8_t []>());
+            payload.size_ = size;
+        }
+
+        return payload;
+    }
+
+    /**
+     * @brief 将多段数据依次复制到一份数据中
+     * 
+     * @param segments 
+     * @param count 
+     * @return SharedPayload 
+     */
+    static SharedPayload copy(DataSegment const *segments, int count)
+    {
+        SharedPayload payload;
+        int size = 0;
+
+        for (int i = 0; i < count; ++ i)
+        {
+            if (segments[i].data && (segments[i].size > 0))
+            {
+                size += segments[i].size;
+            }
+        }
+
+        if (size > 0)
+        {
+            uint8_t *memory = new uint8_t [size];
+            uint8_t *p = memory;
+
+            for (int i = 0; i < count; ++ i)
+            {
+                if (segments[i].data && (segments[i].size > 0))
+                {
+                    ::memcpy(p, segments[i].data, segments[i].size);
+                    p += segments[i].size;
+                }
+            }
+
+            payload.holder_ = std::shared_ptr<uint8_t const>(memory, std::default_delete<uint8_t []>());
+            payload.size_ = size;
+        }
+
+        return payload;
+    }
+
+    /**
+     * @brief 接管一个vector的内存，不复制
+     * 
+     * @param data 
+     * @return SharedPayload 
+     */
+    static SharedPayload adopt(std::vector<uint8_t> &&data)
+    {
+        SharedPayload payload;
+
+        if (!data.empty())
+        {
+            auto owner = std::make_shared<std::vector<uint8_t>>(std::move(data));
+
+            // 别名构造，引用计数属于vector
+            payload.holder_ = std::shared_ptr<uint8_t const>(owner, owner->data());
+            payload.size_ = static_cast<int>(owner->size());
+        }
+
+        return payload;
+    }
+
+    /**
+     * @brief 接管一块new[]分配的内存，不复制
+     * 
+     * @param data 
+     * @param size 
+     * @return SharedPayload 
+     */
+    static SharedPayload adopt(std::unique_ptr<uint8_t []> data, int size)
+    {
+        SharedPayload payload;
+
+        if (data && (size > 0))
+        {
+            payload.holder_ = std::shared_ptr<uint8_t const>(data.release(), std::default_delete<uint8_t []>());
+            payload.size_ = size;
+        }
+
+        return payload;
+    }
+
+    /**
+     * @brief 接管一帧的数据，堆上和共享缓存中的数据不复制，内部存储的小数据复制
+     * 
+     * @param frame 之后为空
+     * @return SharedPayload 
+     */
+    static SharedPayload adopt(DataFrame &&frame);
+
+    uint8_t const * data() const
+    {
+        return holder_.get();
+    }
+
+    int size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return !holder_ || (size_ <= 0);
+    }
+
+    /// 返回引用数量
+    long use_count() const
+    {
+        return holder_.use_count();
+    }
+
+private:
+    std::shared_ptr<uint8_t const> holder_;
+    int size_ = 0;
+};
+
+
+/**
+ * @brief 一个网络数据帧
+ * 
+ * @note 数据有三种存放方式:
+ *   - 不超过InlineSize字节时存放在对象内部，不分配堆内存
+ *   - 更大的数据从堆上分配，复制数据时不先清零
+ *   - 接管共享缓存时只持有缓存引用，不复制
+ */
 class DataFrame
 {
+    /// 发送时接管帧的数据
+    friend class SharedPayload;
 
 public:
-    explicit DataFrame(int size): host_({"", 0}), size_(size) , time_stamp_(0)
+    /// 内部存储的大小，多数控制消息不超过这个长度
+    static constexpr int InlineSize = 64;
+
+    explicit DataFrame(int size): host_({"", 0})
     { 
         //slog::trace("--> DataFrame(size ={})", size_);
 
-        if (size_ > 0)
+        // 只指定大小时数据清零
+        if (allocate(size))
         {
-            data_ = new uint8_t [size_];
             ::memset(data_, 0, size_);
         }
-        else 
-        {
-            data_ = nullptr;
-        }
     }
 
     DataFrame(Host const &host, int size) : DataFrame(size) {
@@ -52,58 +227,50 @@ public:
         host_ = host;
      }
 
-    DataFrame(Host const &host, uint8_t const *data, int size) : DataFrame(host, size)
+    DataFrame(Host const &host, uint8_t const *data, int size) : host_(host)
     {
         //("--> DataFrame(Host const &host, uint8_t *data, int size)");
 
         // 使用一个时间戳来标记一个帧, 仅在数据创建时给值
         time_stamp_ = naiad::system::uptime();
 
-        // 初始化数据
-        ::memcpy(data_, data, size);
+        // 数据会被完整覆盖，不需要先清零
+        if (allocate(size))
+        {
+            ::memcpy(data_, data, size_);
+        }
+    }
+
+    /**
+     * @brief 接管一块共享缓存中的数据，不复制
+     * 
+     * @param host 
+     * @param buffer 缓存引用，帧销毁时释放
+     * @param size 数据长度
+     * @param offset 数据在缓存中的偏移
+     */
+    DataFrame(Host const &host, SharedBuffer buffer, int size, int offset = 0) : 
+        host_(host), 
+        data_(buffer.data() + offset), 
+        size_(size), 
+        time_stamp_(naiad::system::uptime()), 
+        buffer_(std::move(buffer))
+    {
+
     }
 
     // 复制函数
-    DataFrame(DataFrame const & other)
+    DataFrame(DataFrame const & other) : host_(other.host_)
     {
         //slog::trace("--> DataFrame() copy construct");
 
-        host_ = other.host_;
-        if (other.size_ > 0)
-        {
-            size_ = other.size_;
-            data_ = new uint8_t[size_];
-            time_stamp_ = other.time_stamp_;
-    
-            if (other.data_)
-            {
-                ::memcpy(data_, other.data_, size_);
-            }
-            else 
-            {   
-                ::memset(data_, 0, size_);
-            }
-        }
-        else 
-        {
-            size_ = 0;
-            data_ = nullptr;
-            time_stamp_ = 0;
-        }
+        copy_data(other);
     }
 
-    DataFrame(DataFrame && other)
+    DataFrame(DataFrame && other) : host_(std::move(other.host_))
     {
         //slog::trace("--> DataFrame() move construct");        
-        host_ = other.host_;
-        data_ = other.data_;
-        size_ = other.size_;
-        time_stamp_ = other.time_stamp_;
-
-        // 将它清空
-        other.data_ = nullptr;
-        other.size_ = 0;
-        other.time_stamp_ = 0;
+        move_data(other);
     }
 
     /**
@@ -117,33 +284,10 @@ public:
         if (this != &other)
         {
             // 如果当前数据为非空，需要先删除
-            if (data_ != nullptr)
-            {
-                delete [] data_;
-                data_ = nullptr;
-            }
-
-            size_ = other.size_;
-            time_stamp_ = 0;
-            // 如果对端有数据，则需要复制过来
-            if (size_ > 0)
-            {
-                data_ = new uint8_t [size_];
+            release_data();
 
-                if (other.data_)
-                {
-                    ::memcpy(data_, other.data_, size_);
-                    time_stamp_ = other.time_stamp_;
-                }
-                else 
-                {   
-                    ::memset(data_, 0, size_);
-                }
-            }
-            else 
-            {
-                size_ = 0;                
-            }
+            host_ = other.host_;
+            copy_data(other);
         }
 
         return *this;
@@ -159,28 +303,19 @@ public:
     {
         if (this != &other)
         {
-            host_ = other.host_;
-            data_ = other.data_;
-            size_ = other.size_;
-            time_stamp_ = other.time_stamp_;
+            release_data();
 
-            // 将它清空
-            other.data_ = nullptr;
-            other.size_ = 0;
-            other.time_stamp_ = 0;
+            host_ = std::move(other.host_);
+            move_data(other);
         }
 
         return *this;
     }
 
-
     ~DataFrame()
     {
         //slog::trace("--> DataFrame() destruct, size={}, {}", size_,  data_ ? "with data" : "no data");   
-        if (data_)
-        {
-            delete [] data_;
-        }
+        release_data();
     }
 
     /**
@@ -193,6 +328,16 @@ public:
         return host_;
     }
 
+    /**
+     * @brief 返回接收这一帧的连接id，0表示未知
+     * 
+     * @return uint32_t 
+     */
+    uint32_t connection_id() const
+    {
+        return host_.id;
+    }
+
     /**
      * @brief 某些常量帧时，需要返回常量的数据指针
      * 
@@ -263,13 +408,132 @@ public:
 
 private:
     Host host_;
-    uint8_t *data_;
-    int size_;
-    int64_t time_stamp_;
+    uint8_t *data_ = nullptr;
+    int size_ = 0;
+    int64_t time_stamp_ = 0;
+    /// 数据在共享缓存中时，持有缓存的引用，否则为空
+    SharedBuffer buffer_;
+    /// 小数据的内部存储，data_指向这里时不需要释放
+    uint8_t inline_[InlineSize];
+
+    /**
+     * @brief 分配数据存储，不初始化内容
+     * 
+     * @param size 
+     * @return true 有数据
+     * @return false size <= 0，数据为空
+     */
+    bool allocate(int size)
+    {
+        if (size <= 0)
+        {
+            data_ = nullptr;
+            size_ = 0;
+            return false;
+        }
+
+        data_ = (size <= InlineSize) ? inline_ : new uint8_t [size];
+        size_ = size;
+
+        return true;
+    }
 
+    /// 复制对端的数据，调用前当前数据必须为空
+    void copy_data(DataFrame const &other)
+    {
+        time_stamp_ = 0;
+
+        // 如果对端有数据，则需要复制过来
+        if (allocate(other.size_))
+        {
+            if (other.data_)
+            {
+                ::memcpy(data_, other.data_, size_);
+                time_stamp_ = other.time_stamp_;
+            }
+            else 
+            {   
+                ::memset(data_, 0, size_);
+            }
+        }
+    }
+
+    /// 取走对端的数据，调用前当前数据必须为空
+    void move_data(DataFrame &other)
+    {
+        size_ = other.size_;
+        time_stamp_ = other.time_stamp_;
+        buffer_ = std::move(other.buffer_);
+
+        // 内部存储不能转移，只能复制
+        if (other.data_ == other.inline_)
+        {
+            ::memcpy(inline_, other.inline_, size_);
+            data_ = inline_;
+        }
+        else 
+        {
+            data_ = other.data_;
+        }
+
+        // 将它清空
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.time_stamp_ = 0;
+    }
+
+    /// 释放数据
+    void release_data()
+    {
+        if (!buffer_.empty())
+        {
+            buffer_.reset();
+        }
+        else if (data_ && (data_ != inline_))
+        {
+            delete [] data_;
+        }
+
+        data_ = nullptr;
+    }
 };
 
 
+
+inline SharedPayload SharedPayload::adopt(DataFrame &&frame)
+{
+    SharedPayload payload;
+
+    if (frame.is_empty())
+    {
+        return payload;
+    }
+
+    if (!frame.buffer_.empty())
+    {
+        // 持有共享缓存的引用，数据指向缓存中的位置
+        auto owner = std::make_shared<SharedBuffer>(std::move(frame.buffer_));
+        payload.holder_ = std::shared_ptr<uint8_t const>(owner, frame.data_);
+        payload.size_ = frame.size_;
+    }
+    else if (frame.data_ == frame.inline_)
+    {
+        payload = copy(frame.data_, frame.size_);
+    }
+    else 
+    {
+        payload.holder_ = std::shared_ptr<uint8_t const>(frame.data_, std::default_delete<uint8_t []>());
+        payload.size_ = frame.size_;
+    }
+
+    // 数据已转移，将它清空
+    frame.data_ = nullptr;
+    frame.size_ = 0;
+    frame.time_stamp_ = 0;
+
+    return payload;
+}
+
 } // end network
 
 } // end naiad
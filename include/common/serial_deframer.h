@@ -0,0 +1,235 @@
+#ifndef __NAIAD_SERIAL_DEFRAMER_H__
+#define __NAIAD_SERIAL_DEFRAMER_H__
+
+/**
+ * @file serial_deframer.h
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 串口接收分帧器，将字节流还原为完整的帧
+ * @version 0.1
+ * @date 2023-06-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   分帧器在串口的接收路径中运行(接收线程或loop)，只输出完整的帧，支持：
+ *   - LengthFieldDeframer 帧头带长度字段
+ *   - SlipDeframer  SLIP (RFC1055) 编码
+ *   - CobsDeframer  COBS 编码，以0x00分隔
+ *   - IdleGapDeframer 以字节间的空闲时间分帧，如Modbus-RTU的t3.5
+ */
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+namespace naiad
+{
+namespace driver
+{
+
+/**
+ * @brief 分帧器接口
+ *
+ */
+class SerialDeframer
+{
+public:
+    /// 帧输出函数
+    typedef std::function<void(uint8_t const *, int)> Output;
+
+    virtual ~SerialDeframer() { }
+
+    /**
+     * @brief 启动异步接收时调用，传入串口参数
+     *
+     * @param baudrate 波特率
+     * @param char_bits 每个字符的位数(起始位+数据位+校验位+停止位)
+     */
+    virtual void setup([[maybe_unused]] int baudrate, [[maybe_unused]] int char_bits) { }
+
+    /**
+     * @brief 输入一段接收到的数据
+     *
+     * @param data
+     * @param size
+     * @param now_us 数据读出时的时间(us)
+     * @param output 每还原一个完整帧调用一次
+     */
+    virtual void input(uint8_t const *data, int size, int64_t now_us, Output const &output) = 0;
+
+    /**
+     * @brief 返回需要做空闲检测的时间点(us)
+     *
+     * @return int64_t 0 表示不需要
+     */
+    virtual int64_t idle_deadline() const { return 0; }
+
+    /**
+     * @brief 空闲检测，到达idle_deadline()后调用
+     *
+     * @param now_us
+     * @param output
+     */
+    virtual void idle([[maybe_unused]] int64_t now_us, [[maybe_unused]] Output const &output) { }
+
+    /// 清除未完成的数据
+    virtual void reset() = 0;
+
+    /// 配置是否有效，无效的分帧器不能设置到串口
+    virtual bool is_valid() const { return true; }
+
+    /// 返回错误数(格式错误或超长而被丢弃的帧)
+    uint64_t errors() const
+    {
+        return errors_;
+    }
+
+protected:
+    uint64_t errors_ = 0;
+};
+
+
+/**
+ * @brief 帧头带长度字段的分帧器
+ *
+ *   [sync...][...][length][...][payload...]
+ *   帧总长度 = 长度字段的值 + length_adjust
+ */
+class LengthFieldDeframer : public SerialDeframer
+{
+public:
+    struct Config
+    {
+        /// 帧头同步字节，可以为空
+        std::vector<uint8_t> sync;
+        /// 长度字段在帧中的偏移
+        int length_offset;
+        /// 长度字段的字节数，1,2,4
+        int length_size;
+        /// 长度字段是否为大端
+        bool big_endian;
+        /// 帧总长度与长度字段值的差
+        int length_adjust;
+        /// 最大帧长度
+        int max_size;
+    };
+
+    /**
+     * @brief 创建一个长度字段分帧器
+     *
+     * @param config
+     * @note 长度字段的字节数不是1,2,4，偏移为负，或最大帧长度小于帧头时配置无效，is_valid()返回false
+     */
+    explicit LengthFieldDeframer(Config const &config);
+
+    void input(uint8_t const *data, int size, int64_t now_us, Output const &output) override;
+    void reset() override;
+    bool is_valid() const override;
+
+private:
+    Config config_;
+    bool valid_;
+    std::vector<uint8_t> buffer_;
+    /// 有效数据在buffer_中的起始位置
+    std::size_t start_ = 0;
+    /// 帧头的长度(同步字节和长度字段)
+    int header_size_;
+};
+
+
+/**
+ * @brief SLIP (RFC1055) 分帧器
+ *
+ */
+class SlipDeframer : public SerialDeframer
+{
+public:
+    explicit SlipDeframer(int max_size);
+
+    void input(uint8_t const *data, int size, int64_t now_us, Output const &output) override;
+    void reset() override;
+
+private:
+    int max_size_;
+    std::vector<uint8_t> frame_;
+    bool escape_ = false;
+    /// 当前帧超长，丢弃到下一个END
+    bool overflow_ = false;
+};
+
+
+/**
+ * @brief COBS 分帧器，帧以0x00结束
+ *
+ */
+class CobsDeframer : public SerialDeframer
+{
+public:
+    explicit CobsDeframer(int max_size);
+
+    void input(uint8_t const *data, int size, int64_t now_us, Output const &output) override;
+    void reset() override;
+
+private:
+    int max_size_;
+    std::vector<uint8_t> encoded_;
+    std::vector<uint8_t> frame_;
+    bool overflow_ = false;
+
+    bool decode();
+};
+
+
+/**
+ * @brief 以字节间空闲时间分帧，如Modbus-RTU
+ *
+ */
+class IdleGapDeframer : public SerialDeframer
+{
+public:
+    /**
+     * @brief 创建一个空闲分帧器
+     *
+     * @param max_size 最大帧长度
+     * @param gap_us 空闲时间，0 表示按波特率计算t3.5
+     */
+    explicit IdleGapDeframer(int max_size, int gap_us = 0);
+
+    void setup(int baudrate, int char_bits) override;
+    void input(uint8_t const *data, int size, int64_t now_us, Output const &output) override;
+    int64_t idle_deadline() const override;
+    void idle(int64_t now_us, Output const &output) override;
+    void reset() override;
+
+    /// 返回使用的空闲时间(us)
+    int gap_us() const
+    {
+        return gap_us_;
+    }
+
+    /**
+     * @brief 按Modbus-RTU的规则计算t3.5
+     *
+     * @param baudrate
+     * @param char_bits
+     * @return int us，波特率大于19200时固定为1750us
+     */
+    static int modbus_gap_us(int baudrate, int char_bits = 11);
+
+private:
+    int max_size_;
+    int gap_us_;
+    bool auto_gap_;
+    std::vector<uint8_t> frame_;
+    int64_t last_rx_us_ = 0;
+
+    void flush(Output const &output);
+};
+
+
+} // driver
+
+} // naiad
+
+
+#endif // __NAIAD_SERIAL_DEFRAMER_H__
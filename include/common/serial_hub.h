@@ -0,0 +1,148 @@
+#ifndef __NAIAD_SERIAL_HUB_H__
+#define __NAIAD_SERIAL_HUB_H__
+
+/**
+ * @file serial_hub.h
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 使用一个epoll和少量线程处理多个串口的收发
+ * @version 0.1
+ * @date 2023-06-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   每个串口的async_read_start()都会创建一个接收线程和一个epoll，
+ *   串口较多时，可以将它们注册到一个SerialHub中，所有串口共用一个epoll和1~2个线程，
+ *   每个串口的接收队列、统计信息和通知方式保持不变。
+ */
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+
+#include <common/serial_port.h>
+
+namespace naiad
+{
+namespace driver
+{
+
+class SerialHub
+{
+public:
+    /**
+     * @brief 创建一个串口hub
+     *
+     * @param name 名称
+     */
+    explicit SerialHub(std::string const &name = "serial-hub");
+    ~SerialHub();
+
+    // 禁止复制构造
+    SerialHub(const SerialHub &) = delete;
+    SerialHub & operator=(const SerialHub &) = delete;
+
+    /**
+     * @brief 启动IO线程
+     *
+     * @param threads 线程数量，一般1~2个即可
+     * @return true
+     * @return false
+     */
+    bool start(int threads = 1);
+
+    /**
+     * @brief 停止IO线程，并移除所有串口
+     *
+     */
+    void stop();
+
+    /**
+     * @brief 注册一个已打开的串口，开始异步收发
+     *
+     * @param port
+     * @param queue_size 接收队列大小
+     * @return true
+     * @return false
+     */
+    bool add(SerialPort &port, int queue_size = 8192);
+
+#if SERIAL_RX_NOTIFY
+    /**
+     * @brief 注册一个已打开的串口，并注册异步通知
+     *
+     * @param port
+     * @param uv_loop 接收通知的loop
+     * @param signal_handle 异步处理函数
+     * @param queue_size 接收队列大小
+     * @return true
+     * @return false
+     */
+    bool add(SerialPort &port, uv_loop_t *uv_loop, uv::AsyncSignal::Function signal_handle, int queue_size = 8192);
+
+    bool add(SerialPort &port, uv::Loop &loop, uv::AsyncSignal::Function signal_handle, int queue_size = 8192)
+    {
+        return add(port, loop.get(), signal_handle, queue_size);
+    }
+#endif
+
+    /**
+     * @brief 移除一个串口，返回后hub不会再访问该串口
+     *
+     * @param port
+     * @return true
+     * @return false 串口不在hub中
+     */
+    bool remove(SerialPort &port);
+
+    /**
+     * @brief 返回注册的串口数量
+     *
+     * @return int
+     */
+    int ports_num();
+
+    /// 返回名称
+    std::string const & name() const
+    {
+        return name_;
+    }
+
+private:
+    /// 一个注册的串口
+    struct Entry
+    {
+        uint64_t id;
+        SerialPort *port;
+        /// 同一个串口的事件，同时只在一个线程中处理
+        std::mutex mutex;
+        /// 是否在监听可写事件
+        bool tx_waiting = false;
+    };
+
+    std::string name_;
+    int epoll_fd_ = -1;
+    /// 用于唤醒并停止IO线程
+    int stop_event_fd_ = -1;
+    bool running_ = false;
+    std::vector<std::thread> threads_;
+
+    /// 注册的串口，以id为索引，避免事件处理时访问已移除的串口
+    std::unordered_map<uint64_t, std::unique_ptr<Entry>> entries_;
+    std::mutex entries_mutex_;
+    uint64_t next_id_ = 1;
+
+    void io_thread();
+    void handle_event(uint64_t key, uint32_t events);
+    int idle_scan();
+    void rearm(Entry &entry);
+};
+
+} // driver
+
+} // naiad
+
+#endif // __NAIAD_SERIAL_HUB_H__
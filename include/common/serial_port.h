@@ -13,9 +13,17 @@
  */
 #include <termios.h>
 #include <string>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+#include <common/byte_ring_buffer.h>
+#include <common/serial_deframer.h>
 
 // by default ,enable RX_NOTIFY
 #ifndef SERIAL_RX_NOTIFY
@@ -32,6 +40,43 @@ namespace naiad
 namespace driver 
 {
 
+class SerialHub;
+
+/**
+ * @brief 按2的幂分桶的直方图
+ *   第0个桶统计值0，第i个桶统计 [2^(i-1), 2^i) 范围内的值，最后一个桶包含所有更大的值
+ */
+struct SerialHistogram
+{
+    static constexpr int BucketNum = 32;
+
+    uint64_t buckets[BucketNum];
+
+    /// 返回值所在的桶
+    static int bucket_of(uint64_t value)
+    {
+        int index = (value == 0) ? 0 : (64 - __builtin_clzll(value));
+        return (index < BucketNum) ? index : (BucketNum - 1);
+    }
+
+    /// 返回桶能统计的最大值
+    static uint64_t bucket_limit(int index)
+    {
+        return (index == 0) ? 0 : ((1ULL << index) - 1);
+    }
+
+    /// 返回样本总数
+    uint64_t count() const;
+
+    /**
+     * @brief 估算百分位数
+     * 
+     * @param percent 0~100
+     * @return uint64_t 所在桶的上限，没有样本时为0
+     */
+    uint64_t percentile(double percent) const;
+};
+
 /**
  * @brief 串口收发统计
  * 
@@ -43,12 +88,67 @@ struct SerialStatistics
     uint64_t rx_bytes;
     uint64_t tx_bytes;
     uint64_t rx_drop_bytes;
+    /// 分帧模式下，接收到的完整帧数
+    uint64_t rx_frames;
+    /// 分帧模式下，格式错误或超长被丢弃的帧数
+    uint64_t rx_frame_errors;
+    /// 异步发送队列中等待发送的字节数
+    uint64_t tx_pending_bytes;
+    /// 异步发送因超过高水位而被拒绝的次数
+    uint64_t tx_rejects;
+    /// 异步发送因串口出错而丢弃的字节数
+    uint64_t tx_drop_bytes;
+
+    /// 接收线程(或loop)每次从串口读到的字节数
+    SerialHistogram rx_chunk_sizes;
+    /// 数据从串口读出到被async_read()/consume()/async_read_frame()取走的时间(us)
+    SerialHistogram rx_latency_us;
+    /// 每次放入数据后接收队列的占用字节数
+    SerialHistogram fifo_usage;
+};
+
+/**
+ * @brief 打开串口时的扩展参数
+ * 
+ */
+struct SerialExtendedOptions
+{
+    /// 设置ASYNC_LOW_LATENCY标志，驱动支持时(如FTDI)会缩短接收延时
+    bool low_latency = false;
+    /// 允许标准列表以外的波特率，通过termios2/BOTHER设置
+    bool custom_baudrate = false;
+    /**
+     * termios 的VMIN/VTIME(单位100ms)
+     *   VTIME为0时，只有接收到VMIN个字节，select/epoll才会返回可读，
+     *   可以减少唤醒次数，但不足VMIN的尾部数据要等到后续数据到达才能读出
+     */
+    int vmin = 1;
+    int vtime = 0;
+};
+
+/**
+ * @brief 打开串口后实际生效的设置，从驱动读回
+ * 
+ */
+struct SerialAppliedSettings
+{
+    /// 驱动报告的波特率，无法读回时为0
+    int baudrate;
+    /// 是否通过termios2/BOTHER设置了波特率
+    bool custom_baudrate;
+    /// ASYNC_LOW_LATENCY是否生效
+    bool low_latency;
+    int vmin;
+    int vtime;
 };
 
 
 class SerialPort
 {
 public:
+    /// 异步发送回调函数，参数为本次写入串口的字节数，在接收线程(或loop)中调用
+    typedef std::function<void(int)> WriteCallback;
+
     SerialPort(const std::string &device);
     ~SerialPort();
 
@@ -67,6 +167,24 @@ public:
      */
     bool open(const char *options);
 
+    /**
+     * @brief 使用扩展参数打开串口
+     * 
+     * @param options 格式同open(options)，允许custom_baudrate时可以使用任意波特率
+     * @param extended 扩展参数
+     * @return true 
+     * @return false 
+     * @note 驱动不支持的扩展设置只给出警告，不影响打开，实际结果通过applied_settings()查看
+     */
+    bool open(const char *options, SerialExtendedOptions const &extended);
+
+    /**
+     * @brief 返回打开时实际生效的设置
+     * 
+     * @return SerialAppliedSettings 
+     */
+    SerialAppliedSettings applied_settings();
+
     /**
      * @brief 是否已打开
      * 
@@ -102,10 +220,50 @@ public:
     int write(const void *buf, int size);
 
 
+    /**
+     * @brief 设置异步发送的高低水位
+     * 
+     * @param high 队列中的数据达到高水位后，async_write()不再接收新数据
+     * @param low 发送到低水位以下后，恢复接收新数据
+     */
+    void set_write_watermark(int high, int low);
+
+    /**
+     * @brief 设置异步发送回调函数，有数据写入串口或解除反压时调用
+     * 
+     * @param callback 
+     */
+    void set_write_callback(WriteCallback callback);
+
+    /**
+     * @brief 异步写入数据，数据放入发送队列后立即返回，由接收线程(或loop)在串口可写时合并写入
+     * 
+     * @param buf 
+     * @param size 
+     * @return int 放入队列的字节数，超过高水位时返回0，未启动异步接收时返回-1
+     */
+    int async_write(const void *buf, int size);
+
+    /**
+     * @brief 异步写入数据，转移缓存的所有权，不需要复制
+     * 
+     * @param data 
+     * @return int 放入队列的字节数，超过高水位时返回0，未启动异步接收时返回-1
+     */
+    int async_write(std::vector<uint8_t> &&data);
+
+    /**
+     * @brief 异步发送是否可以继续写入(未超过高水位)
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool async_writable();
+
     /**
      * @brief 启动异步读
      * 
-     * @param queue_size 
+     * @param queue_size 接收队列大小(字节)，队列满后新数据将被丢弃
      * @return true 
      * @return false 
      */
@@ -135,16 +293,41 @@ public:
     {
         return async_read_start(loop.get(), signal_handle, queue_size);
     }
+
+    /**
+     * @brief 启动异步接收，串口直接注册到指定loop中，不创建接收线程
+     * 
+     * @param uv_loop 监听串口的loop
+     * @param signal_handle 接收到数据后在loop中直接调用
+     * @param queue_size 队列大小
+     * @return bool  
+     * @note 该模式下async_read_stop()和close()需要在loop线程中调用
+     */
+    bool async_poll_start(uv_loop_t *uv_loop, uv::AsyncSignal::Function signal_handle, int queue_size = 8192);
+
+    /**
+     * @brief 启动异步接收，串口直接注册到指定loop中，不创建接收线程
+     * 
+     * @param loop 监听串口的loop
+     * @param signal_handle 接收到数据后在loop中直接调用
+     * @param queue_size 队列大小
+     * @return bool  
+     */
+    bool async_poll_start(uv::Loop & loop, uv::AsyncSignal::Function signal_handle, int queue_size = 8192)
+    {
+        return async_poll_start(loop.get(), signal_handle, queue_size);
+    }
 #endif 
 
     /**
      * @brief 停止异步读
      * 
+     * @note 发送队列中未写完的数据保留，再次启动后继续发送；close()时丢弃
      */
     void async_read_stop();
 
     /**
-     * @brief 异步读数据
+     * @brief 异步读数据，同一时间只能有一个线程读取
      * 
      * @param buf 
      * @param size 
@@ -152,6 +335,64 @@ public:
      */
     int async_read(void *buf, int size);
 
+    /**
+     * @brief 等待接收队列中至少有min_size个字节后再读取，同一时间只能有一个线程读取
+     * 
+     * @param buf 
+     * @param size 
+     * @param min_size 最少需要的字节数，超过size时按size处理
+     * @param timeout 等待时间(ms)，小于0时一直等待
+     * @return int 读到的字节数，超时或停止接收时返回已有的数据(可能为0)，未启动异步接收或在分帧模式下返回-1
+     * @note 在接收线程或hub模式下使用，等待时线程休眠，由接收线程唤醒；
+     *       不能在async_poll_start()使用的loop中调用
+     */
+    int async_read_wait(void *buf, int size, int min_size, int timeout);
+
+    /**
+     * @brief 不拷贝地查看接收队列中的数据，与async_read()在同一线程中使用
+     * 
+     * @param first 第一段连续数据
+     * @param second 第二段连续数据，数据在队列中未回绕时为空
+     * @return int 可查看的总字节数
+     * @note 返回的数据在consume()之前保持有效
+     */
+    int peek(ByteRingBuffer::Span &first, ByteRingBuffer::Span &second);
+
+    /**
+     * @brief 从接收队列中丢弃已处理的数据
+     * 
+     * @param size 
+     * @return int 实际丢弃的字节数
+     */
+    int consume(int size);
+
+    /**
+     * @brief 设置接收分帧器，需要在启动异步接收前设置
+     * 
+     * @param deframer 分帧器，为空时取消分帧
+     * @return true 
+     * @return false 异步接收在运行，或分帧器的配置无效
+     * @note 设置分帧器后，接收数据在接收线程(或loop)中分帧，只有完整的帧才放入队列并通知，
+     *       此时使用async_read_frame()读取，async_read()和peek()不再返回数据
+     */
+    bool set_deframer(std::unique_ptr<SerialDeframer> deframer);
+
+    /**
+     * @brief 分帧模式下，读取一个完整帧
+     * 
+     * @param frame 输出的帧
+     * @return true 
+     * @return false 没有完整帧
+     */
+    bool async_read_frame(std::vector<uint8_t> &frame);
+
+    /**
+     * @brief 分帧模式下，返回队列中的帧数量
+     * 
+     * @return int 
+     */
+    int async_frames_num();
+
     /**
      * @brief 刷新缓存
      * 
@@ -182,6 +423,9 @@ public:
     static bool check_options(const char *options);
 
 private:
+    /// hub直接调用接收和发送的处理函数
+    friend class SerialHub;
+
     int fd_;
     std::string path_;
     std::string name_;
@@ -190,28 +434,191 @@ private:
     
     /// 保存默认配置，在关闭时恢复到默认值
     struct termios default_options_;
+    /// 修改ASYNC_LOW_LATENCY前的串口标志，-1 表示未修改
+    int default_serial_flags_ = -1;
+    /// 实际生效的设置
+    SerialAppliedSettings applied_ = { };
 
-    /// 接收队列 
-    std::queue<unsigned char> rx_queue_;
-    /// 队列锁
-    std::mutex rx_queue_mutex_;
+    /// 接收队列，接收线程写入，async_read()读出
+    ByteRingBuffer rx_queue_;
     /// 接收线程
     std::thread rx_thread_;
+
+    /// async_read_wait()使用，由接收线程在数据足够时唤醒
+    std::mutex rx_wait_mutex_;
+    std::condition_variable rx_wait_cond_;
+    /// 等待的最少字节数，0 表示没有线程在等待
+    std::atomic<std::size_t> rx_wait_size_ {0};
+    /// 异步接收已停止，等待的线程不再等待
+    std::atomic<bool> rx_wait_stopped_ {true};
     /// 接收线程是否在运行
     bool rx_thread_running_;
+    /// 注册到的hub，由hub负责收发
+    SerialHub *rx_hub_ = nullptr;
 #if SERIAL_RX_NOTIFY
     uv::AsyncSignal rx_signal_;
+    /// loop监听模式
+    uv::Poll rx_poll_;
+    /// loop监听模式下的数据处理函数
+    uv::AsyncSignal::Function rx_poll_handle_;
+    /// loop监听模式是否在运行
+    bool rx_poll_running_ = false;
+    /// loop监听模式下，分帧器的空闲检测定时器
+    uv::Timer rx_idle_timer_;
+    /// loop监听模式下，发送唤醒事件的监听
+    uv::Poll tx_wakeup_poll_;
 #endif 
 
-    /// 串口统计信息
-    SerialStatistics statistics_;
-    std::mutex statistics_mutex_;
+    /// 异步发送队列
+    std::deque<std::vector<uint8_t>> tx_queue_;
+    /// 队列头部缓存已写入的字节数
+    std::size_t tx_offset_ = 0;
+    std::size_t tx_pending_bytes_ = 0;
+    std::size_t tx_high_watermark_ = 64 * 1024;
+    std::size_t tx_low_watermark_ = 16 * 1024;
+    /// 超过高水位，等待降到低水位
+    bool tx_blocked_ = false;
+    uint64_t tx_rejects_ = 0;
+    std::mutex tx_mutex_;
+    WriteCallback tx_callback_;
+    /// 发送唤醒事件
+    int tx_event_fd_ = -1;
+
+    /// 波特率
+    int baudrate_ = 0;
+    /// 每个字符的位数
+    int char_bits_ = 10;
+
+    /// 分帧器
+    std::unique_ptr<SerialDeframer> deframer_;
+    SerialDeframer::Output rx_frame_output_;
+    /// 一个完整帧及其接收时间
+    struct RxFrame
+    {
+        std::vector<uint8_t> data;
+        int64_t time_us;
+    };
+
+    /// 帧队列
+    std::deque<RxFrame> rx_frames_;
+    std::size_t rx_frames_bytes_ = 0;
+    std::mutex rx_frames_mutex_;
+    /// 有新数据需要通知使用者
+    bool rx_ready_ = false;
+
+    /// 无锁的直方图计数，只使用relaxed原子操作
+    struct HistogramCounter
+    {
+        std::atomic<uint64_t> buckets[SerialHistogram::BucketNum];
+
+        void reset()
+        {
+            for (auto &b : buckets)
+            {
+                b.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void add(uint64_t value)
+        {
+            buckets[SerialHistogram::bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void load(SerialHistogram &histogram) const
+        {
+            for (int i = 0; i < SerialHistogram::BucketNum; ++ i)
+            {
+                histogram.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+    };
+
+    /// 串口统计信息，热路径上只做relaxed原子操作，不加锁
+    uint32_t fifo_size_ = 0;
+    std::atomic<uint32_t> fifo_peak_size_ {0};
+    std::atomic<uint64_t> rx_bytes_ {0};
+    std::atomic<uint64_t> tx_bytes_ {0};
+    std::atomic<uint64_t> rx_drop_bytes_ {0};
+    std::atomic<uint64_t> rx_frames_num_ {0};
+    std::atomic<uint64_t> rx_frame_errors_ {0};
+    std::atomic<uint64_t> tx_drop_bytes_ {0};
+    HistogramCounter rx_chunk_sizes_;
+    HistogramCounter rx_latency_us_;
+    HistogramCounter fifo_usage_;
+
+    /// 接收时间戳，记录队列中某个位置的数据的读出时间，用于统计接收延时
+    struct RxStamp
+    {
+        /// 这包数据结束时的累计写入字节数
+        uint64_t end;
+        int64_t time_us;
+    };
+
+    /// 时间戳队列，接收线程写入，读取数据的线程取出，满时不再记录(相当于抽样)
+    static constexpr uint32_t RxStampNum = 256;
+    RxStamp rx_stamps_[RxStampNum];
+    std::atomic<uint32_t> rx_stamp_head_ {0};
+    std::atomic<uint32_t> rx_stamp_tail_ {0};
+    /// 累计写入接收队列的字节数，只由接收线程访问
+    uint64_t rx_pushed_bytes_ = 0;
+    /// 累计从接收队列取走的字节数，只由读取线程访问
+    uint64_t rx_popped_bytes_ = 0;
     bool rx_queue_half_alert_ = false;
     bool rx_queue_three_quarter_alert_ = false;
     bool rx_queue_full_alert_ = false;
 
 
-    int read_with_epoll(int fd, int epoll_fd, void *buf, int size, int timeout);
+    /// 检查异步接收的运行状态，并初始化接收队列
+    bool async_read_prepare(int queue_size);
+
+    /// 将接收到的一包数据放入接收队列
+    void rx_input(uint8_t const *buf, int size);
+
+    /// 读空串口中的数据，放入接收队列，返回读到的字节数
+    int rx_read_available();
+
+    /// 接收队列已满，丢弃数据
+    void rx_drop(std::size_t size);
+
+    /// 记录一包数据写入接收队列的时间
+    void rx_stamp(std::size_t pushed, int64_t now_us);
+
+    /// 数据从接收队列中取走，统计延时
+    void rx_popped(std::size_t size);
+
+    /// 分帧器输出一个完整帧
+    void rx_frame_input(uint8_t const *data, int size);
+
+    /// 返回帧队列中的数据量
+    std::size_t rx_frame_bytes();
+
+    /// 分帧器的空闲检测，返回下一次检测的时间点(us)
+    int64_t rx_idle_check();
+
+    /// 有新数据时通知使用者
+    void rx_notify();
+
+    /// 唤醒async_read_wait()
+    void rx_wait_wakeup(bool force);
+
+#if SERIAL_RX_NOTIFY
+    /// loop模式下启动空闲检测定时器
+    void rx_idle_timer_start();
+#endif 
+
+    /// 异步收发是否在运行(接收线程、loop或hub)
+    bool async_running();
+
+    /// 接收线程
+    void rx_thread_loop();
+
+    /// 唤醒接收线程(或loop)处理发送队列
+    void tx_wakeup();
+    void tx_wakeup_clear();
+
+    /// 将发送队列中的数据合并写入串口，返回是否还有数据未写完
+    bool tx_drain();
+
     int read_with_select(int fd, void *buf, int size, int timeout);
 
 };
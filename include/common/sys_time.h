@@ -34,6 +34,18 @@ static inline int64_t uptime(void)
     return ms.count();
 }
 
+/**
+ * @brief 返回一个微秒级的时间戳
+ * 
+ * @return int64_t 
+ */
+static inline int64_t uptime_us(void)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch());
+    return us.count();
+}
+
 /**
  * @brief 返回当前系统时间
  * 
@@ -31,10 +31,14 @@
 #include <thread>
 #include <optional>
 #include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <condition_variable>
 
 #include <common/uv_helper.h>
 #include <common/network_client.h>
 #include <common/network_frame.h>
+#include <common/buffer_pool.h>
 
 namespace naiad
 {
@@ -44,7 +48,68 @@ namespace network
 
 /// 声明一个TCP连接内部类型
 class TcpConnection;
+/// 声明一个loop分片内部类型
+class TcpShard;
+/// 声明一个发送帧内部类型
+struct TxFrame;
 
+/**
+ * @brief 发送流控统计信息
+ * 
+ */
+struct TcpWriteStatistics
+{
+    /// 连接进入拥塞的次数
+    uint64_t congested;
+    /// 发送者被阻塞的次数
+    uint64_t blocked;
+    /// 拥塞时丢弃的新帧数量
+    uint64_t dropped_newest;
+    /// 拥塞时丢弃的旧帧数量
+    uint64_t dropped_oldest;
+    /// 因拥塞断开的连接数量
+    uint64_t disconnected;
+};
+
+
+/**
+ * @brief 接收队列统计信息
+ * 
+ */
+struct TcpReadStatistics
+{
+    /// 队列中的帧数量
+    std::size_t queued_frames;
+    /// 队列中的字节数
+    std::size_t queued_bytes;
+    /// 队列满时暂停读取的次数，按连接计
+    uint64_t paused;
+    /// 队列满时丢弃的新帧数量
+    uint64_t dropped_newest;
+    /// 队列满时丢弃的旧帧数量
+    uint64_t dropped_oldest;
+};
+
+
+/**
+ * @brief 按长度字段分帧的配置
+ * 
+ *   [...][length][...][payload...]
+ *   消息总长度 = 长度字段的值 + length_adjust
+ */
+struct TcpFramerConfig
+{
+    /// 长度字段在消息中的偏移
+    int length_offset;
+    /// 长度字段的字节数，1,2,4，为0时不分帧
+    int length_size;
+    /// 长度字段是否为大端
+    bool big_endian;
+    /// 消息总长度与长度字段值的差，如长度只包含负载时为头部长度
+    int length_adjust;
+    /// 最大消息长度，不能超过接收缓存的块大小
+    int max_size;
+};
 
 
 /**
@@ -65,9 +130,33 @@ public:
     static const uv::AsyncSignal::SignalId SignalReceiveFrame;
     static const uv::AsyncSignal::SignalId SignalConnectionLost;
 
-    /// 定义一个接收回调函数
+    /// 定义一个接收回调函数，host中带有连接id，可以直接用于send()
     typedef std::function<void(Host const & host, void const * const data, std::size_t size)> ReceiveCallback;
 
+    /// 连接的发送队列超过高水位时的处理策略
+    enum class WritePolicy : int 
+    {
+        /// 阻塞发送者，直到所有连接降到低水位以下
+        Block = 0,
+        /// 丢弃新的帧
+        DropNewest,
+        /// 缓存新的帧，缓存超过(高水位-低水位)时丢弃最早的帧
+        DropOldest,
+        /// 断开连接
+        Disconnect,
+    };
+
+    /// 接收队列达到上限时的处理策略
+    enum class ReadPolicy : int 
+    {
+        /// 暂停读取产生数据的连接，由TCP窗口让对端降速，队列降到上限的一半以下时恢复
+        Pause = 0,
+        /// 丢弃新的帧
+        DropNewest,
+        /// 丢弃最早的帧
+        DropOldest,
+    };
+
     /**
      * @brief 创建一个TCP服务端
      * 
@@ -78,6 +167,21 @@ public:
      */
     TcpServer(std::string const &name, std::string const &address, int port, std::size_t max_clients_num = 10);
 
+    /**
+     * @brief 创建一个使用外部loop的TCP服务端，不创建loop线程，多个服务可以共用一个loop
+     * 
+     * @param loop 外部loop，由使用者运行，需要比服务端存在更久
+     * @param name 名称
+     * @param address 地址
+     * @param port 端口
+     * @param max_clients_num  最大连接数，0 不限制 
+     * 
+     * @note start()和stop()需要在loop的线程中调用，在这个线程中send()直接写出，
+     *   ReceiveCallback也在这个线程中直接调用；析构时不运行loop，句柄在loop下次运行时释放，
+     *   不能在这个服务端自己的回调中析构
+     */
+    TcpServer(uv::Loop &loop, std::string const &name, std::string const &address, int port, std::size_t max_clients_num = 10);
+
     /**
      * @brief 创建一个默认参数的TCP服务
      * 
@@ -162,6 +266,23 @@ public:
      */
     DataFrame receive();
 
+    /**
+     * @brief 在一次加锁中从队列中取出多帧数据
+     * 
+     * @param frames 先清空，再加入取出的帧，可以重复使用以保留容量
+     * @param max_frames 最多取出的帧数量
+     * @return int 取出的帧数量
+     */
+    int receive_batch(std::vector<DataFrame> &frames, int max_frames = 64);
+
+    /**
+     * @brief 等待并接收一帧数据，不需要外部loop
+     * 
+     * @param timeout 超时时间(ms)，小于0时一直等待
+     * @return DataFrame 超时或服务停止时DataFrame.is_empty() 为真
+     */
+    DataFrame receive_wait(int timeout);
+
     /**
      * @brief 接收通知绑定到外部Loop
      * 
@@ -184,7 +305,7 @@ public:
     /**
      * @brief 发送数据到指定客户端
      * 
-     * @param host 指定主机，如果host = AllClients 表示发给所有客户端
+     * @param host 指定主机，如果host = AllClients 表示发给所有客户端，host.id非0时按id查找连接
      * @param data 需要发送的数据
      * @param size 
      * @return true 发送成功
@@ -202,6 +323,61 @@ public:
      */
     bool send(DataFrame const &frame);
 
+    /**
+     * @brief 发送一帧并接管它的数据，不复制，写完成后释放
+     * 
+     * @param frame 发送后为空
+     * @return true 
+     * @return false 
+     */
+    bool send(DataFrame &&frame);
+
+    /**
+     * @brief 发送数据并接管vector的内存，不复制，写完成后释放
+     * 
+     * @param host 指定主机，同send(host, data, size)
+     * @param data 
+     * @return true 
+     * @return false 
+     */
+    bool send(Host const & host, std::vector<uint8_t> &&data);
+
+    /**
+     * @brief 发送数据并接管new[]分配的内存，不复制，写完成后释放
+     * 
+     * @param host 指定主机，同send(host, data, size)
+     * @param data 
+     * @param size 数据长度
+     * @return true 
+     * @return false 
+     */
+    bool send(Host const & host, std::unique_ptr<uint8_t []> data, int size);
+
+    /**
+     * @brief 分段发送，复制所有分段到一块连续的数据
+     * 
+     * @param host 指定主机，同send(host, data, size)
+     * @param segments 分段列表，例如协议头、数据、校验
+     * @param count 分段数量
+     * @return true 发送成功
+     * @return false 发送失败
+     * 
+     * @note 调用者不需要先拼接到临时缓存，数据只复制一次
+     */
+    bool send(Host const & host, DataSegment const *segments, int count);
+
+    /**
+     * @brief 分段发送共享数据，不复制
+     * 
+     * @param host 指定主机，同send(host, data, size)
+     * @param segments 分段列表，每段作为一个uv_buf_t写出，同一个连接中各段连续，不会与其他帧交错
+     * @return true 发送成功
+     * @return false 发送失败
+     * 
+     * @note 分段在写完成前被持有，同一份数据(例如广播的负载)可以出现在多次发送中
+     */
+    bool send(Host const & host, std::vector<SharedPayload> segments);
+
     /// 返回连接数量 
     int connections_num();
 
@@ -216,9 +392,92 @@ public:
      * 
      */
     void dump_clients();
+
+    /**
+     * @brief 设置接收缓存池，需要在start()之前调用
+     * 
+     * @param block_size 每块大小，即每次读取的最大字节数
+     * @param block_num 块数量，所有连接共用，用完时从堆上分配
+     * @param huge_pages 是否使用大页
+     * @return true 
+     * @return false 
+     */
+    bool set_read_buffers(std::size_t block_size, std::size_t block_num, bool huge_pages = false);
+
+    /**
+     * @brief 返回接收缓存池的统计信息，包括命中和未命中次数
+     * 
+     * @return BufferPoolStatistics 
+     */
+    BufferPoolStatistics get_read_buffer_statistics();
+
+    /**
+     * @brief 设置每个连接的发送水位和拥塞策略，需要在start()之前调用
+     * 
+     * @param high 连接未写出的字节数超过高水位时，进入拥塞
+     * @param low 降到低水位以下时，解除拥塞
+     * @param policy 拥塞时的处理策略
+     * @return true 
+     * @return false 
+     */
+    bool set_write_watermarks(std::size_t high, std::size_t low, WritePolicy policy);
+
+    /**
+     * @brief 返回发送流控统计信息
+     * 
+     * @return TcpWriteStatistics 
+     */
+    TcpWriteStatistics get_write_statistics();
+
+    /**
+     * @brief 设置接收队列的上限和策略，需要在start()之前调用，使用ReceiveCallback时无效
+     * 
+     * @param max_frames 最多帧数量，0 不限制
+     * @param max_bytes 最多字节数，0 不限制
+     * @param policy 达到上限时的处理策略
+     * @return true 
+     * @return false 
+     * 
+     * @note Pause策略时，暂停前已读到的数据仍然入队列，队列可能短暂超过上限
+     */
+    bool set_read_queue_limits(std::size_t max_frames, std::size_t max_bytes, ReadPolicy policy = ReadPolicy::Pause);
+
+    /**
+     * @brief 返回接收队列统计信息
+     * 
+     * @return TcpReadStatistics 
+     */
+    TcpReadStatistics get_read_statistics();
+
+    /**
+     * @brief 设置loop线程数量，需要在start()之前调用
+     * 
+     * @param threads 线程数量，大于1时每个线程使用SO_REUSEPORT监听同一端口，
+     *   由内核将新连接分配到各个线程，每个连接只在一个线程中处理
+     * @return true 
+     * @return false 
+     * 
+     * @note 多线程时，ReceiveCallback可能在多个线程中同时调用，get_loop()返回第一个线程的loop
+     */
+    bool set_loop_threads(int threads);
+
+    /**
+     * @brief 设置按长度字段分帧，需要在start()之前调用
+     * 
+     * @param config 分帧配置，length_size为0时不分帧
+     * @return true 
+     * @return false 
+     * 
+     * @note 分帧后ReceiveCallback和接收队列只收到完整的消息，消息在连接的接收缓存中原地拼接，
+     *   长度非法时断开连接
+     */
+    bool set_framer(TcpFramerConfig const &config);
     
 
 private:
+    /// 分片使用服务端的内部状态
+    friend class TcpShard;
+
     /// 地址
     std::string address_;
     /// 端口
@@ -229,27 +488,68 @@ private:
     /// 最大连接数
     std::size_t max_clients_num_;
     /// 是否已启动
-    bool started_ = false;
+    std::atomic<bool> started_ {false};
     /// 简要信息
     std::string brief_;
 
-    /// TCP线程
-    std::thread thread_;
-    bool thread_exit_ = false;
+    /// 是否使用外部loop
+    bool attached_ = false;
+    /// loop线程数量，即分片数量
+    int loop_threads_ = 1;
+    /// 分片，每个分片一个loop线程和一个监听句柄，分片0使用基类的loop
+    std::vector<std::unique_ptr<TcpShard>> shards_;
 
-    /// TCP连接队列
-    std::vector<std::unique_ptr<TcpConnection>> connections_;
-    /// 客户端信息
+    /// 所有分片的连接数量
+    std::atomic<int> connections_num_ {0};
+    /// 客户端信息，所有分片共用
     std::vector<std::unique_ptr<ClientInfo>> clients_;
+    std::mutex clients_mutex_;
+    /// 接收缓存池，所有连接共用，队列中的帧可以持有其中的缓存
+    BufferPool::Ptr rx_pool_;
     /// 接收帧FIFO
     std::queue<DataFrame> rx_frames_;
-    /// 发送帧FIFO
-    std::queue<DataFrame> tx_frames_;
+    /// 分帧配置
+    TcpFramerConfig framer_ {0, 0, true, 0, 0};
+
+    /// 接收队列上限及策略，0 不限制
+    std::size_t read_max_frames_ = 0;
+    std::size_t read_max_bytes_ = 0;
+    ReadPolicy read_policy_ = ReadPolicy::Pause;
+    /// 接收队列中的字节数
+    std::size_t rx_bytes_ = 0;
+    /// 是否有连接因接收队列满暂停读取
+    bool rx_paused_ = false;
+    /// 接收队列统计，以上均由rx_mutex_保护
+    uint64_t read_paused_ = 0;
+    uint64_t read_dropped_newest_ = 0;
+    uint64_t read_dropped_oldest_ = 0;
+
+    /// 发送水位及拥塞策略
+    std::size_t write_high_ = 16 * 1024 * 1024;
+    std::size_t write_low_ = 4 * 1024 * 1024;
+    WritePolicy write_policy_ = WritePolicy::DropNewest;
+
+    /// 发送流控统计
+    std::atomic<uint64_t> write_congested_ {0};
+    std::atomic<uint64_t> write_blocked_ {0};
+    std::atomic<uint64_t> write_dropped_newest_ {0};
+    std::atomic<uint64_t> write_dropped_oldest_ {0};
+    std::atomic<uint64_t> write_disconnected_ {0};
+
+    /// Block策略时，拥塞的连接数量，发送者等待它为0
+    std::atomic<int> write_congested_num_ {0};
+    /// Block策略时，已加入发送队列、loop线程还未处理的字节数，超过高水位时发送者等待
+    std::atomic<std::size_t> write_pending_bytes_ {0};
+    /// 正在等待的发送者数量
+    std::atomic<int> write_waiters_ {0};
+    std::mutex write_wait_mutex_;
+    std::condition_variable write_wait_cond_;
 
     std::mutex rx_mutex_;
-    std::mutex tx_mutex_;
-
-    uv::AsyncSignal tx_notify_;
+    /// 接收等待，有帧入队列或服务停止时唤醒
+    std::condition_variable rx_cond_;
+    /// 服务已停止，等待接收的线程返回
+    bool rx_stopped_ = true;
 
     // 给外部线程使用，通知外部线程数据准备好
     uv::AsyncSignal rx_notify_;
@@ -257,11 +557,6 @@ private:
     // 接收回调函数 
     ReceiveCallback receive_callback_;
 
-    /**
-     * @brief 处理新连接
-     */
-    void setup_connection();
-
     /**
      * @brief 获取一个客户端信息对象
      * 
@@ -272,9 +567,79 @@ private:
     ClientInfo & get_client_info(std::string const & address, int port);
 
     /**
-     * @brief LOOP执行线程
+     * @brief 更新连接关联的客户端信息
+     * 
+     * @param connection 
+     */
+    void sync_client_info(TcpConnection &connection);
+
+    /**
+     * @brief 当前线程是否为某个分片的loop线程
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool in_loop_thread();
+
+    /**
+     * @brief Block策略时，发送者是否需要等待
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool write_blocked()
+    {
+        return (write_congested_num_.load() > 0) || (write_pending_bytes_.load() > write_high_);
+    }
+
+    /**
+     * @brief 有发送者在等待时唤醒它们，重新检查是否需要等待
+     * 
+     */
+    void write_wakeup();
+
+    /**
+     * @brief 将一帧交给目标连接所在的分片
+     * 
+     * @param frame 
+     * @return true 
+     * @return false 
+     */
+    bool send_frame(TxFrame &&frame);
+
+    /**
+     * @brief 接收队列加入一帧后是否超过上限，需要持有rx_mutex_
+     * 
+     * @param size 
+     * @return true 
+     * @return false 
+     */
+    bool read_queue_exceeded(std::size_t size) const
+    {
+        return ((read_max_frames_ > 0) && (rx_frames_.size() + 1 > read_max_frames_)) 
+            || ((read_max_bytes_ > 0) && (rx_bytes_ + size > read_max_bytes_));
+    }
+
+    /**
+     * @brief 从接收队列取出一帧，需要持有rx_mutex_
+     * 
+     * @return DataFrame 
+     */
+    DataFrame read_queue_pop();
+
+    /**
+     * @brief 取出帧后检查是否可以恢复读取，需要持有rx_mutex_
+     * 
+     * @return true 需要调用read_resume()
+     * @return false 
+     */
+    bool read_queue_drained();
+
+    /**
+     * @brief 通知所有分片恢复暂停读取的连接
+     * 
      */
-    void loop_thread();
+    void read_resume();
 };
 
 
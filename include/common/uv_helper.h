@@ -163,8 +163,9 @@ public:
             timer_handle_ = handle;
         }
 
-        uv_timer_init(loop, &timer_);
-        timer_.data = this;
+        timer_ = new uv_timer_t;
+        uv_timer_init(loop_, timer_);
+        timer_->data = this;
 
         return true;
     }
@@ -178,12 +179,13 @@ public:
     {
         if (started_)
         {
-            uv_timer_stop(&timer_);
+            uv_timer_stop(timer_);
             started_ = false;            
         }
     }
 
     /// @brief 关闭定时器
+    /// @note 句柄在关闭回调中释放，对象可以在关闭回调执行前析构
     void close()
     {
         // 先停止
@@ -193,7 +195,11 @@ public:
         if (loop_)
         {
             // 从loop中移除
-            uv_close((uv_handle_t *)&timer_, nullptr);
+            timer_->data = nullptr;
+            uv_close((uv_handle_t *)timer_, [](uv_handle_t *handle) {
+                    delete reinterpret_cast<uv_timer_t *>(handle);
+                });
+            timer_ = nullptr;
             loop_ = nullptr;
         }
 
@@ -213,15 +219,15 @@ public:
             timer_handle_ = handle;
         }
 
-        // 如果handle为空，不允许启动
-        if (!timer_handle_){
+        // 如果handle为空或未绑定，不允许启动
+        if (!timer_handle_ || !loop_){
             return ;
         }
 
         // 如果已启动，就不再启动了
         if (!started_)
         {
-            uv_timer_start(&timer_, [](uv_timer_t *handle)
+            uv_timer_start(timer_, [](uv_timer_t *handle)
                 {
                     auto self = reinterpret_cast<Timer *>(handle->data);
                     if (self && self->timer_handle_)
@@ -234,7 +240,7 @@ public:
         else 
         {
             // 只修改周期
-            uv_timer_set_repeat(&timer_, period_ms);
+            uv_timer_set_repeat(timer_, period_ms);
         }
         
         period_ = period_ms;
@@ -255,13 +261,137 @@ public:
 private:
     uv_loop_t *loop_;
     bool started_ = false;
-    uv_timer_t timer_;   
+    uv_timer_t *timer_ = nullptr;
     int period_ = 0;
     Function timer_handle_;
 };
 
 
 
+/// 文件描述符事件监听，fd就绪时在loop中回调
+class Poll
+{
+public:
+
+    /// 定义一个事件回调函数，参数为status和就绪的事件(UV_READABLE/UV_WRITABLE)
+    typedef std::function<void(int, int)> Function;
+
+    Poll() : loop_(nullptr), poll_handle_(nullptr) { }
+
+    ~Poll()
+    {
+        close();
+    }
+
+    /// @brief 绑定fd到指定的loop
+    /// @param loop 如果为空，表示使用默认的loop
+    /// @param fd 
+    /// @param handle 
+    /// @return 
+    bool bind(uv_loop_t *loop, int fd, Function handle)
+    {
+        // 是否已绑定，需要关闭才能再次绑定
+        if (loop_ != nullptr)
+        {
+            return false;
+        }
+
+        loop_ = !loop ? uv_default_loop() : loop;
+
+        poll_ = new uv_poll_t;
+        if (uv_poll_init(loop_, poll_, fd) != 0)
+        {
+            delete poll_;
+            poll_ = nullptr;
+            loop_ = nullptr;
+            return false;
+        }
+
+        poll_handle_ = handle;
+        poll_->data = this;
+
+        return true;
+    }
+
+    bool bind(Loop &loop, int fd, Function handle)
+    {
+        return bind(loop.get(), fd, handle);
+    }
+
+    /**
+     * @brief 开始(或修改)监听的事件
+     * 
+     * @param events UV_READABLE | UV_WRITABLE
+     * @return true 
+     * @return false 
+     */
+    bool start(int events)
+    {
+        if (!loop_ || !poll_handle_)
+        {
+            return false;
+        }
+
+        int ret = uv_poll_start(poll_, events, [](uv_poll_t *handle, int status, int events)
+            {
+                auto self = reinterpret_cast<Poll *>(handle->data);
+                if (self && self->poll_handle_)
+                {
+                    self->poll_handle_(status, events);
+                }
+            });
+
+        if (ret == 0)
+        {
+            events_ = events;
+        }
+
+        return (ret == 0);
+    }
+
+    /// 当前监听的事件
+    int events() const
+    {
+        return events_;
+    }
+
+    /// 停止监听
+    void stop()
+    {
+        if (loop_ && events_)
+        {
+            uv_poll_stop(poll_);
+            events_ = 0;
+        }
+    }
+
+    /// @brief 关闭，关闭后可以重新绑定
+    /// @note 句柄在关闭回调中释放，对象可以在关闭回调执行前析构
+    void close()
+    {
+        stop();
+
+        if (loop_)
+        {
+            poll_->data = nullptr;
+            uv_close((uv_handle_t *)poll_, [](uv_handle_t *handle) {
+                    delete reinterpret_cast<uv_poll_t *>(handle);
+                });
+            poll_ = nullptr;
+            loop_ = nullptr;
+        }
+
+        poll_handle_ = nullptr;
+    }
+
+private:
+    uv_loop_t *loop_;
+    uv_poll_t *poll_ = nullptr;
+    int events_ = 0;
+    Function poll_handle_;
+};
+
+
 /// 异步信号, 用于外部进程通知本地loop消息
 class AsyncSignal
 {
@@ -305,8 +435,9 @@ public:
         }
 
         signal_handle_ = handle;
-        async_.data = this;
-        uv_async_init(loop, &async_, [](uv_async_t *handle){
+        async_ = new uv_async_t;
+        async_->data = this;
+        uv_async_init(loop, async_, [](uv_async_t *handle){
             auto self = reinterpret_cast<AsyncSignal *>(handle->data);
             if (self && self->signal_handle_){
                 self->signal_handle_(self->id_);
@@ -328,11 +459,16 @@ public:
 
 
     /// @brief 关闭信号，可以重新绑定使用
+    /// @note 句柄在关闭回调中释放，对象可以在关闭回调执行前析构
     void close()
     {
         if (signal_handle_)
         {
-            uv_close((uv_handle_t *)&async_, nullptr);
+            async_->data = nullptr;
+            uv_close((uv_handle_t *)async_, [](uv_handle_t *handle) {
+                    delete reinterpret_cast<uv_async_t *>(handle);
+                });
+            async_ = nullptr;
             signal_handle_ = nullptr;
         }
     }
@@ -345,13 +481,13 @@ public:
     {
         if (signal_handle_)
         {
-            uv_async_send(&async_);
+            uv_async_send(async_);
         }
     }
 
 private:
     SignalId id_;
-    uv_async_t async_;
+    uv_async_t *async_ = nullptr;
     Function signal_handle_;
 };
 
@@ -374,6 +510,13 @@ public:
      */
     TcpServer(Loop::Type type = Loop::Type::Default);
 
+    /**
+     * @brief 使用一个外部的loop，不创建也不关闭这个loop
+     * 
+     * @param loop 
+     */
+    explicit TcpServer(uv_loop_t *loop);
+
     ~TcpServer();
 
     // 禁止复制构造
@@ -394,6 +537,8 @@ protected:
     uv_loop_t *loop_;
     uv_tcp_t server_;
     uv_async_t async_stop_;
+    /// loop是否由这个对象创建，外部loop不初始化async_stop_
+    bool own_loop_ = true;
 
 
     /**
@@ -417,7 +562,7 @@ protected:
 
 
     /**
-     * @brief 异步停止TCP服务
+     * @brief 异步停止TCP服务，使用外部loop时无效
      * 
      */
     void async_stop();
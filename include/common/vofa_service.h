@@ -46,13 +46,28 @@ public:
         // 实例化一个TCP服务
         tcp_server_ = std::make_unique<naiad::network::TcpServer>(name_, ipv4_address, ip_port, 2);
 
-        // 初始化数据
-        for (auto & id : data_set)
-        {
-            data_cache_[id] = 0.0f;
-        }
+        init_datas(data_set);
+    }
 
-        slog::info("{}: init with {} datas, {} mode", name_, data_cache_.size(), (report_period_ > 0) ? "period" : "trigger");
+    /**
+     * @brief 使用外部loop，不创建线程，定时器和发送都在这个loop中执行
+     * 
+     * @param loop 外部loop，start()和stop()需要在它的线程中调用；析构时不运行loop，
+     *   定时器和连接的句柄在loop下次运行时释放
+     * @param ipv4_address 
+     * @param ip_port 
+     * @param data_set 数据集
+     * @param period_ms 周期，0 - 使用上报触发，> 0， 周期触发
+     */
+    VofaService(uv::Loop &loop, std::string const & ipv4_address, int ip_port, std::vector<uint32_t> const & data_set, int period_ms = 0)
+    {
+        name_ = "vofa-" + std::to_string(ip_port);
+
+        report_period_ = period_ms;
+        // 实例化一个TCP服务，共用外部loop
+        tcp_server_ = std::make_unique<naiad::network::TcpServer>(loop, name_, ipv4_address, ip_port, 2);
+
+        init_datas(data_set);
     }
 
     /// 启动该服务
@@ -178,6 +193,17 @@ private:
     // 创建一个定时器
     uv::Timer timer_;
 
+    /// 初始化数据
+    void init_datas(std::vector<uint32_t> const & data_set)
+    {
+        for (auto & id : data_set)
+        {
+            data_cache_[id] = 0.0f;
+        }
+
+        slog::info("{}: init with {} datas, {} mode", name_, data_cache_.size(), (report_period_ > 0) ? "period" : "trigger");
+    }
+
 
     void send_datas()
     {
@@ -0,0 +1,241 @@
+
+/**
+ * @file buffer_pool.cpp
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 固定大小的内存块缓存池
+ * @version 0.1
+ * @date 2023-07-03
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <sys/mman.h>
+#include <errno.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <common/logger.h>
+#include <common/buffer_pool.h>
+
+namespace naiad
+{
+
+namespace network
+{
+
+/// 大页大小
+#define HUGE_PAGE_SIZE   (2 * 1024 * 1024)
+
+
+BufferPool::BufferPool(std::size_t block_size, std::size_t block_num, bool huge_pages) :
+    block_size_(block_size),
+    block_num_(block_num),
+    huge_pages_(huge_pages)
+{
+    // 块大小按cache line对齐
+    block_size_ = (block_size_ + sizeof(Block) - 1) & ~(sizeof(Block) - 1);
+}
+
+BufferPool::~BufferPool()
+{
+    // 只在所有块都归还后才会析构
+    if (slab_)
+    {
+        munmap(slab_, slab_size_);
+        slab_ = nullptr;
+    }
+}
+
+/**
+ * @brief 分配slab，并建立空闲链表
+ *
+ * @return true
+ * @return false
+ */
+bool BufferPool::setup_slab()
+{
+    if (block_num_ == 0)
+    {
+        return false;
+    }
+
+    std::size_t stride = sizeof(Block) + block_size_;
+    std::size_t size = stride * block_num_;
+    void *slab = MAP_FAILED;
+
+    if (huge_pages_)
+    {
+        std::size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~static_cast<std::size_t>(HUGE_PAGE_SIZE - 1);
+
+        slab = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (slab != MAP_FAILED)
+        {
+            size = huge_size;
+            huge_pages_used_ = true;
+        }
+        else
+        {
+            slog::debug("buffer pool: MAP_HUGETLB failed: {}, use normal pages", strerror(errno));
+        }
+    }
+
+    if (slab == MAP_FAILED)
+    {
+        slab = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED)
+        {
+            slog::error("buffer pool: mmap({}) failed: {}", size, strerror(errno));
+            return false;
+        }
+
+        // 不能使用大页时，建议内核使用透明大页
+        if (huge_pages_)
+        {
+            madvise(slab, size, MADV_HUGEPAGE);
+        }
+    }
+
+    slab_ = slab;
+    slab_size_ = size;
+
+    uint8_t *p = static_cast<uint8_t *>(slab_);
+    for (std::size_t i = 0; i < block_num_; ++ i)
+    {
+        Block *block = new (p + i * stride) Block;
+        block->pool = this;
+        block->next = free_list_;
+        free_list_ = block;
+    }
+
+    free_num_ = block_num_;
+
+    slog::debug("buffer pool: {} x {} bytes, {} bytes{}", block_num_, block_size_, slab_size_, huge_pages_used_ ? " on huge pages" : "");
+
+    return true;
+}
+
+uint8_t * BufferPool::allocate()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (!slab_ && !slab_failed_)
+        {
+            slab_failed_ = !setup_slab();
+        }
+
+        if (free_list_)
+        {
+            Block *block = free_list_;
+            free_list_ = block->next;
+            free_num_ --;
+
+            // 未归还的块持有缓存池的引用
+            refs_.fetch_add(1, std::memory_order_relaxed);
+            block->refs.store(1, std::memory_order_relaxed);
+
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return block->data();
+        }
+    }
+
+    // 池已用完，从堆上分配
+    misses_.fetch_add(1, std::memory_order_relaxed);
+
+    void *memory = ::malloc(sizeof(Block) + block_size_);
+    if (memory == nullptr)
+    {
+        return nullptr;
+    }
+
+    Block *block = new (memory) Block;
+    block->pool = nullptr;
+    block->next = nullptr;
+    block->refs.store(1, std::memory_order_relaxed);
+
+    return block->data();
+}
+
+void BufferPool::retain(uint8_t *data)
+{
+    Block::from_data(data)->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BufferPool::release(uint8_t *data)
+{
+    if (data == nullptr)
+    {
+        return ;
+    }
+
+    Block *block = Block::from_data(data);
+
+    if (block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        return ;
+    }
+
+    if (block->pool == nullptr)
+    {
+        block->~Block();
+        ::free(block);
+        return ;
+    }
+
+    block->pool->put_back(block);
+}
+
+int BufferPool::use_count(uint8_t const *data)
+{
+    // acquire: 读到1时，其他线程释放引用前对数据的访问都已完成，可以改写
+    return Block::from_data(data)->refs.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief 将一块内存放回空闲链表
+ *
+ * @param block
+ */
+void BufferPool::put_back(Block *block)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        block->next = free_list_;
+        free_list_ = block;
+        free_num_ ++;
+    }
+
+    unref();
+}
+
+/**
+ * @brief 释放一个缓存池的引用，为0时销毁
+ *
+ */
+void BufferPool::unref()
+{
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete this;
+    }
+}
+
+BufferPoolStatistics BufferPool::get_statistics()
+{
+    BufferPoolStatistics stats;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.block_size = block_size_;
+    stats.block_num = slab_ ? block_num_ : 0;
+    stats.free_num = free_num_;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.huge_pages = huge_pages_used_;
+
+    return stats;
+}
+
+} // network
+
+} // end naiad
@@ -0,0 +1,393 @@
+
+/**
+ * @file serial_deframer.cpp
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 串口接收分帧器的实现
+ * @version 0.1
+ * @date 2023-06-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <cstring>
+#include <algorithm>
+
+#include <common/logger.h>
+#include <common/serial_deframer.h>
+
+namespace naiad
+{
+
+namespace driver
+{
+
+/// SLIP 控制字符
+#define SLIP_END      0xC0
+#define SLIP_ESC      0xDB
+#define SLIP_ESC_END  0xDC
+#define SLIP_ESC_ESC  0xDD
+
+
+LengthFieldDeframer::LengthFieldDeframer(Config const &config) : config_(config)
+{
+    header_size_ = std::max(static_cast<int>(config_.sync.size()), config_.length_offset + config_.length_size);
+
+    valid_ = ((config_.length_size == 1) || (config_.length_size == 2) || (config_.length_size == 4))
+        && (config_.length_offset >= 0)
+        && (config_.max_size >= header_size_);
+
+    if (!valid_)
+    {
+        slog::warning("invalid length field deframer config: offset={}, size={}, sync={}, max={}", 
+            config_.length_offset, config_.length_size, config_.sync.size(), config_.max_size);
+    }
+}
+
+bool LengthFieldDeframer::is_valid() const
+{
+    return valid_;
+}
+
+void LengthFieldDeframer::reset()
+{
+    buffer_.clear();
+    start_ = 0;
+}
+
+void LengthFieldDeframer::input(uint8_t const *data, int size, [[maybe_unused]] int64_t now_us, Output const &output)
+{
+    if (!valid_)
+    {
+        return ;
+    }
+
+    // 已处理的数据较多时，将剩余数据移到头部
+    if ((start_ > 0) && (start_ >= buffer_.size() / 2))
+    {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + start_);
+        start_ = 0;
+    }
+
+    buffer_.insert(buffer_.end(), data, data + size);
+
+    std::size_t const sync_size = config_.sync.size();
+
+    while (buffer_.size() - start_ >= static_cast<std::size_t>(header_size_))
+    {
+        uint8_t const *p = buffer_.data() + start_;
+
+        // 检查同步字节，不匹配时丢弃一个字节重新同步
+        if (sync_size > 0 && ::memcmp(p, config_.sync.data(), sync_size) != 0)
+        {
+            uint8_t const *next = static_cast<uint8_t const *>(::memchr(p + 1, config_.sync[0], buffer_.size() - start_ - 1));
+            start_ = next ? (next - buffer_.data()) : buffer_.size();
+            errors_ ++;
+            continue;
+        }
+
+        // 取长度字段
+        uint32_t length = 0;
+        uint8_t const *field = p + config_.length_offset;
+        for (int i = 0; i < config_.length_size; ++ i)
+        {
+            int index = config_.big_endian ? i : (config_.length_size - 1 - i);
+            length = (length << 8) | field[index];
+        }
+
+        int64_t total = static_cast<int64_t>(length) + config_.length_adjust;
+
+        if ((total < header_size_) || (total > config_.max_size))
+        {
+            // 长度非法，当作同步错误处理
+            start_ ++;
+            errors_ ++;
+            continue;
+        }
+
+        if (buffer_.size() - start_ < static_cast<std::size_t>(total))
+        {
+            // 等待更多数据
+            break;
+        }
+
+        output(p, static_cast<int>(total));
+        start_ += total;
+    }
+
+    if (start_ == buffer_.size())
+    {
+        buffer_.clear();
+        start_ = 0;
+    }
+}
+
+
+SlipDeframer::SlipDeframer(int max_size) : max_size_(max_size)
+{
+    frame_.reserve(max_size_);
+}
+
+void SlipDeframer::reset()
+{
+    frame_.clear();
+    escape_ = false;
+    overflow_ = false;
+}
+
+void SlipDeframer::input(uint8_t const *data, int size, [[maybe_unused]] int64_t now_us, Output const &output)
+{
+    for (int i = 0; i < size; ++ i)
+    {
+        uint8_t c = data[i];
+
+        if (c == SLIP_END)
+        {
+            if (overflow_)
+            {
+                errors_ ++;
+            }
+            else if (!frame_.empty())
+            {
+                output(frame_.data(), static_cast<int>(frame_.size()));
+            }
+
+            frame_.clear();
+            escape_ = false;
+            overflow_ = false;
+            continue;
+        }
+
+        if (escape_)
+        {
+            escape_ = false;
+
+            if (c == SLIP_ESC_END)
+            {
+                c = SLIP_END;
+            }
+            else if (c == SLIP_ESC_ESC)
+            {
+                c = SLIP_ESC;
+            }
+            else
+            {
+                // 非法的转义，丢弃这一帧
+                overflow_ = true;
+            }
+        }
+        else if (c == SLIP_ESC)
+        {
+            escape_ = true;
+            continue;
+        }
+
+        if (overflow_)
+        {
+            continue;
+        }
+
+        if (static_cast<int>(frame_.size()) >= max_size_)
+        {
+            overflow_ = true;
+            continue;
+        }
+
+        frame_.push_back(c);
+    }
+}
+
+
+CobsDeframer::CobsDeframer(int max_size) : max_size_(max_size)
+{
+    // 编码后最多增加 n/254 + 1 个字节
+    encoded_.reserve(max_size_ + max_size_ / 254 + 2);
+    frame_.reserve(max_size_);
+}
+
+void CobsDeframer::reset()
+{
+    encoded_.clear();
+    overflow_ = false;
+}
+
+/**
+ * @brief 解码encoded_到frame_
+ *
+ * @return true
+ * @return false 格式错误
+ */
+bool CobsDeframer::decode()
+{
+    std::size_t i = 0;
+    std::size_t n = encoded_.size();
+
+    frame_.clear();
+
+    while (i < n)
+    {
+        uint8_t code = encoded_[i ++];
+
+        if ((code == 0) || (i + code - 1 > n))
+        {
+            return false;
+        }
+
+        frame_.insert(frame_.end(), encoded_.begin() + i, encoded_.begin() + i + code - 1);
+        i += code - 1;
+
+        // 0xFF 块后面没有隐含的0，最后一个块也没有
+        if ((code != 0xFF) && (i < n))
+        {
+            frame_.push_back(0);
+        }
+    }
+
+    return (static_cast<int>(frame_.size()) <= max_size_);
+}
+
+void CobsDeframer::input(uint8_t const *data, int size, [[maybe_unused]] int64_t now_us, Output const &output)
+{
+    std::size_t const max_encoded = max_size_ + max_size_ / 254 + 1;
+
+    while (size > 0)
+    {
+        uint8_t const *end = static_cast<uint8_t const *>(::memchr(data, 0, size));
+        int chunk = end ? static_cast<int>(end - data) : size;
+
+        if (!overflow_)
+        {
+            if (encoded_.size() + chunk > max_encoded)
+            {
+                overflow_ = true;
+                encoded_.clear();
+            }
+            else
+            {
+                encoded_.insert(encoded_.end(), data, data + chunk);
+            }
+        }
+
+        if (!end)
+        {
+            break;
+        }
+
+        // 遇到分隔符，处理一帧
+        if (overflow_)
+        {
+            errors_ ++;
+        }
+        else if (!encoded_.empty())
+        {
+            if (decode())
+            {
+                output(frame_.data(), static_cast<int>(frame_.size()));
+            }
+            else
+            {
+                errors_ ++;
+            }
+        }
+
+        encoded_.clear();
+        overflow_ = false;
+
+        data += chunk + 1;
+        size -= chunk + 1;
+    }
+}
+
+
+IdleGapDeframer::IdleGapDeframer(int max_size, int gap_us) :
+    max_size_(max_size),
+    gap_us_(gap_us),
+    auto_gap_(gap_us <= 0)
+{
+    if (auto_gap_)
+    {
+        gap_us_ = modbus_gap_us(9600);
+    }
+
+    frame_.reserve(max_size_);
+}
+
+int IdleGapDeframer::modbus_gap_us(int baudrate, int char_bits)
+{
+    // 波特率大于19200时，使用固定值1.75ms
+    if ((baudrate <= 0) || (baudrate > 19200))
+    {
+        return 1750;
+    }
+
+    // 3.5个字符的时间
+    return static_cast<int>((35LL * char_bits * 1000000LL) / (10LL * baudrate));
+}
+
+void IdleGapDeframer::setup(int baudrate, int char_bits)
+{
+    if (auto_gap_)
+    {
+        gap_us_ = modbus_gap_us(baudrate, char_bits);
+    }
+
+    slog::debug("idle-gap deframer: baudrate {}, gap {}us", baudrate, gap_us_);
+}
+
+void IdleGapDeframer::reset()
+{
+    frame_.clear();
+    last_rx_us_ = 0;
+}
+
+void IdleGapDeframer::flush(Output const &output)
+{
+    if (!frame_.empty())
+    {
+        if (static_cast<int>(frame_.size()) > max_size_)
+        {
+            errors_ ++;
+        }
+        else
+        {
+            output(frame_.data(), static_cast<int>(frame_.size()));
+        }
+
+        frame_.clear();
+    }
+}
+
+void IdleGapDeframer::input(uint8_t const *data, int size, int64_t now_us, Output const &output)
+{
+    // 距离上次数据已超过空闲时间，上一帧已结束
+    if (!frame_.empty() && (now_us - last_rx_us_ >= gap_us_))
+    {
+        flush(output);
+    }
+
+    // 超长的数据只计数，不保存，在帧结束时丢弃
+    if (static_cast<int>(frame_.size()) <= max_size_)
+    {
+        std::size_t room = max_size_ + 1 - frame_.size();
+        frame_.insert(frame_.end(), data, data + std::min(room, static_cast<std::size_t>(size)));
+    }
+
+    last_rx_us_ = now_us;
+}
+
+int64_t IdleGapDeframer::idle_deadline() const
+{
+    return frame_.empty() ? 0 : (last_rx_us_ + gap_us_);
+}
+
+void IdleGapDeframer::idle(int64_t now_us, Output const &output)
+{
+    if (!frame_.empty() && (now_us - last_rx_us_ >= gap_us_))
+    {
+        flush(output);
+    }
+}
+
+
+} // driver
+
+} // end naiad
@@ -0,0 +1,458 @@
+
+/**
+ * @file serial_hub.cpp
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 使用一个epoll和少量线程处理多个串口的收发
+ * @version 0.1
+ * @date 2023-06-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   每个串口向epoll注册两个fd: 串口本身和发送唤醒的eventfd，
+ *   均使用EPOLLONESHOT，处理完成后再重新监听，保证同一个fd不会同时在两个线程中处理
+ */
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+
+#include <common/logger.h>
+#include <common/sys_time.h>
+#include <common/serial_hub.h>
+
+namespace naiad
+{
+
+namespace driver
+{
+
+/// epoll事件的key，最低位表示是否为发送唤醒事件
+#define HUB_KEY(id, tx)   (((id) << 1) | ((tx) ? 1 : 0))
+#define HUB_KEY_ID(key)   ((key) >> 1)
+#define HUB_KEY_TX(key)   (((key) & 1) != 0)
+
+/// 用于停止事件的key
+#define HUB_KEY_STOP      0
+
+
+SerialHub::SerialHub(std::string const &name) : name_(name)
+{
+
+}
+
+SerialHub::~SerialHub()
+{
+    stop();
+}
+
+/**
+ * @brief 启动IO线程
+ *
+ * @param threads
+ * @return true
+ * @return false
+ */
+bool SerialHub::start(int threads)
+{
+    if (running_)
+    {
+        slog::warning("{}: already started", name_);
+        return false;
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0)
+    {
+        slog::error("{}: epoll_create1() failed: {}", name_, strerror(errno));
+        return false;
+    }
+
+    stop_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_event_fd_ < 0)
+    {
+        slog::error("{}: eventfd() failed: {}", name_, strerror(errno));
+        ::close(epoll_fd_);
+        epoll_fd_ = -1;
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = HUB_KEY_STOP;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_event_fd_, &ev);
+
+    running_ = true;
+
+    threads = std::max(threads, 1);
+    for (int i = 0; i < threads; ++ i)
+    {
+        threads_.emplace_back(&SerialHub::io_thread, this);
+    }
+
+    slog::info("{}: started with {} io threads", name_, threads);
+
+    return true;
+}
+
+/**
+ * @brief 停止IO线程，并移除所有串口
+ *
+ */
+void SerialHub::stop()
+{
+    if (!running_)
+    {
+        return ;
+    }
+
+    // 先移除所有串口
+    std::vector<SerialPort *> ports;
+    {
+        std::lock_guard<std::mutex> lock(entries_mutex_);
+        for (auto &it : entries_)
+        {
+            ports.push_back(it.second->port);
+        }
+    }
+
+    for (auto port : ports)
+    {
+        remove(*port);
+    }
+
+    running_ = false;
+
+    // 唤醒所有线程
+    uint64_t one = 1;
+    if (::write(stop_event_fd_, &one, sizeof(one)) < 0)
+    {
+        slog::warning("{}: wakeup failed: {}", name_, strerror(errno));
+    }
+
+    for (auto &t : threads_)
+    {
+        t.join();
+    }
+
+    threads_.clear();
+
+    ::close(stop_event_fd_);
+    stop_event_fd_ = -1;
+    ::close(epoll_fd_);
+    epoll_fd_ = -1;
+
+    slog::info("{}: stopped", name_);
+}
+
+/**
+ * @brief 注册一个已打开的串口
+ *
+ * @param port
+ * @param queue_size
+ * @return true
+ * @return false
+ */
+bool SerialHub::add(SerialPort &port, int queue_size)
+{
+    if (!running_)
+    {
+        slog::warning("{}: add serial({}) failed, hub is not running", name_, port.name());
+        return false;
+    }
+
+    if (!port.async_read_prepare(queue_size))
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(entries_mutex_);
+
+    auto entry = std::make_unique<Entry>();
+    entry->id = next_id_ ++;
+    entry->port = &port;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = HUB_KEY(entry->id, false);
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, port.fd_, &ev) < 0)
+    {
+        slog::error("{}: add serial({}) failed: {}", name_, port.name(), strerror(errno));
+        return false;
+    }
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = HUB_KEY(entry->id, true);
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, port.tx_event_fd_, &ev) < 0)
+    {
+        slog::error("{}: add serial({}) failed: {}", name_, port.name(), strerror(errno));
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, port.fd_, nullptr);
+        return false;
+    }
+
+    port.rx_hub_ = this;
+    entries_.emplace(entry->id, std::move(entry));
+
+    slog::debug("{}: serial({}) added, total: {}", name_, port.name(), entries_.size());
+
+    return true;
+}
+
+#if SERIAL_RX_NOTIFY
+/**
+ * @brief 注册一个已打开的串口，并注册异步通知
+ *
+ * @param port
+ * @param uv_loop
+ * @param signal_handle
+ * @param queue_size
+ * @return true
+ * @return false
+ */
+bool SerialHub::add(SerialPort &port, uv_loop_t *uv_loop, uv::AsyncSignal::Function signal_handle, int queue_size)
+{
+    if (port.async_running())
+    {
+        slog::warning("serial({}) aync-read is running", port.name());
+        return false;
+    }
+
+    port.rx_signal_.bind(uv_loop, signal_handle);
+
+    bool ret = add(port, queue_size);
+    if (!ret)
+    {
+        port.rx_signal_.close();
+    }
+
+    return ret;
+}
+#endif
+
+/**
+ * @brief 移除一个串口
+ *
+ * @param port
+ * @return true
+ * @return false
+ */
+bool SerialHub::remove(SerialPort &port)
+{
+    std::unique_ptr<Entry> entry;
+
+    {
+        std::lock_guard<std::mutex> lock(entries_mutex_);
+
+        auto it = std::find_if(entries_.begin(), entries_.end(), [&port](decltype(entries_)::value_type const &e) {
+                return e.second->port == &port;
+            });
+
+        if (it == entries_.end())
+        {
+            return false;
+        }
+
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, port.fd_, nullptr);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, port.tx_event_fd_, nullptr);
+
+        entry = std::move(it->second);
+        entries_.erase(it);
+
+        // 等待正在进行的处理完成，之后不会再有线程能找到这个串口
+        std::lock_guard<std::mutex> entry_lock(entry->mutex);
+    }
+
+    port.rx_hub_ = nullptr;
+
+    #if SERIAL_RX_NOTIFY
+    port.rx_signal_.close();
+    #endif
+
+    slog::debug("{}: serial({}) removed", name_, port.name());
+
+    return true;
+}
+
+/**
+ * @brief 返回注册的串口数量
+ *
+ * @return int
+ */
+int SerialHub::ports_num()
+{
+    std::lock_guard<std::mutex> lock(entries_mutex_);
+    return static_cast<int>(entries_.size());
+}
+
+/**
+ * @brief 重新监听串口的事件
+ *
+ * @param entry
+ */
+void SerialHub::rearm(Entry &entry)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT | (entry.tx_waiting ? static_cast<uint32_t>(EPOLLOUT) : 0);
+    ev.data.u64 = HUB_KEY(entry.id, false);
+
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, entry.port->fd_, &ev);
+}
+
+/**
+ * @brief 处理一个epoll事件
+ *
+ * @param key
+ * @param events
+ */
+void SerialHub::handle_event(uint64_t key, uint32_t events)
+{
+    std::unique_lock<std::mutex> entry_lock;
+    Entry *entry;
+
+    {
+        std::lock_guard<std::mutex> lock(entries_mutex_);
+
+        auto it = entries_.find(HUB_KEY_ID(key));
+        if (it == entries_.end())
+        {
+            // 已被移除
+            return ;
+        }
+
+        entry = it->second.get();
+        entry_lock = std::unique_lock<std::mutex>(entry->mutex);
+    }
+
+    SerialPort &port = *entry->port;
+
+    if (HUB_KEY_TX(key))
+    {
+        port.tx_wakeup_clear();
+
+        bool pending = port.tx_drain();
+
+        // 发送唤醒事件重新监听
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.u64 = key;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, port.tx_event_fd_, &ev);
+
+        // 需要等待串口可写
+        if (pending && !entry->tx_waiting)
+        {
+            entry->tx_waiting = true;
+            rearm(*entry);
+        }
+    }
+    else
+    {
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        {
+            port.rx_read_available();
+        }
+
+        if (events & EPOLLOUT)
+        {
+            entry->tx_waiting = port.tx_drain();
+        }
+
+        port.rx_idle_check();
+        port.rx_notify();
+
+        rearm(*entry);
+    }
+}
+
+/**
+ * @brief 对使用分帧器的串口做空闲检测
+ *
+ * @return int 下一次检测需要等待的时间(ms)，-1 表示不需要
+ */
+int SerialHub::idle_scan()
+{
+    int64_t next = 0;
+
+    std::lock_guard<std::mutex> lock(entries_mutex_);
+
+    for (auto &it : entries_)
+    {
+        Entry &entry = *it.second;
+
+        if (!entry.port->deframer_)
+        {
+            continue;
+        }
+
+        // 正在被其他线程处理，由它负责
+        std::unique_lock<std::mutex> entry_lock(entry.mutex, std::try_to_lock);
+        if (!entry_lock.owns_lock())
+        {
+            continue;
+        }
+
+        int64_t deadline = entry.port->rx_idle_check();
+        entry.port->rx_notify();
+
+        if ((deadline > 0) && ((next == 0) || (deadline < next)))
+        {
+            next = deadline;
+        }
+    }
+
+    if (next == 0)
+    {
+        return -1;
+    }
+
+    int64_t wait = (next - naiad::system::uptime_us() + 999) / 1000;
+    return static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(wait, 10)));
+}
+
+/**
+ * @brief IO线程
+ *
+ */
+void SerialHub::io_thread()
+{
+    #define HUB_MAX_EVENTS  16
+    struct epoll_event events[HUB_MAX_EVENTS];
+
+    slog::trace("{}: io thread started", name_);
+
+    int timeout = -1;
+
+    while (running_)
+    {
+        int nfds = epoll_wait(epoll_fd_, events, HUB_MAX_EVENTS, timeout);
+
+        if ((nfds < 0) && (errno != EINTR))
+        {
+            slog::error("{}: epoll_wait() failed: {}", name_, strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < nfds; ++ i)
+        {
+            if (events[i].data.u64 == HUB_KEY_STOP)
+            {
+                // 停止事件不清除，让所有线程都能退出
+                continue;
+            }
+
+            handle_event(events[i].data.u64, events[i].events);
+        }
+
+        timeout = idle_scan();
+    }
+
+    slog::trace("{}: io thread exited", name_);
+}
+
+
+} // driver
+
+} // end naiad
@@ -17,16 +17,26 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 
 #include <string>
 #include <thread>
-#include <queue>
+#include <chrono>
+#include <algorithm>
 
 #include <common/logger.h>
 #include <common/serial_port.h>
 #include <common/sys_time.h>
+#include <common/serial_deframer.h>
+#include <common/serial_hub.h>
 
-#define ASYNC_READ_WITH_EPOLL  1
+#include "serial_termios2.h"
+
+/// 异步发送时，一次writev最多合并的缓存数
+#define TX_IOV_MAX  64
 
 
 namespace naiad 
@@ -146,7 +156,9 @@ static int to_sys_baudrate(int baudrate)
 /// 一个串口设置示例
 struct SerialSetting
 {
+    /// 系统的波特率常量，为0时表示需要通过termios2设置
     int baudrate;
+    int rate;
     int data_bits;
     int stop_bits;
     bool parity_odd;
@@ -159,10 +171,11 @@ struct SerialSetting
  * 
  * @param options 
  * @param opts 
+ * @param allow_custom 是否允许标准列表以外的波特率
  * @return true 
  * @return false 
  */
-static bool parse_options(const char *options, SerialSetting &set)
+static bool parse_options(const char *options, SerialSetting &set, bool allow_custom = false)
 {
     if (options == nullptr)
     {
@@ -170,6 +183,7 @@ static bool parse_options(const char *options, SerialSetting &set)
     }
 
     set.baudrate = B115200;
+    set.rate = 115200;
     set.data_bits = 8;
     set.stop_bits = 1;
     set.parity_odd = false;
@@ -203,9 +217,10 @@ static bool parse_options(const char *options, SerialSetting &set)
         //解析
         if (result[0])
         {
-            set.baudrate = to_sys_baudrate(strtoul(result[0], NULL, 10));
+            set.rate = strtoul(result[0], NULL, 10);
+            set.baudrate = to_sys_baudrate(set.rate);
 
-            if (set.baudrate == 0)
+            if ((set.baudrate == 0) && !(allow_custom && (set.rate > 0)))
             {
                 slog::warning("invalid serial baudrate: {}", result[0]);
                 return false;
@@ -277,9 +292,15 @@ SerialPort::SerialPort(const std::string &device) : fd_(-1), path_(device)
         name_ = path_;
     }
 
-    statistics_ = { };
+    rx_chunk_sizes_.reset();
+    rx_latency_us_.reset();
+    fifo_usage_.reset();
 
     rx_thread_running_ = false;
+
+    rx_frame_output_ = [this](uint8_t const *data, int size) {
+        rx_frame_input(data, size);
+    };
 }
 
 
@@ -303,7 +324,52 @@ const std::string & SerialPort::name()
     return name_;
 }
 
+/**
+ * @brief 读取串口标志(serial_struct.flags)
+ * 
+ * @param fd 
+ * @return int 驱动不支持时返回-1
+ */
+static int get_serial_flags(int fd)
+{
+    struct serial_struct serial;
+
+    if (ioctl(fd, TIOCGSERIAL, &serial) < 0)
+    {
+        return -1;
+    }
+
+    return serial.flags;
+}
+
+/**
+ * @brief 设置串口标志(serial_struct.flags)
+ * 
+ * @param fd 
+ * @param flags 
+ * @return true 
+ * @return false 
+ */
+static bool set_serial_flags(int fd, int flags)
+{
+    struct serial_struct serial;
+
+    if (ioctl(fd, TIOCGSERIAL, &serial) < 0)
+    {
+        return false;
+    }
+
+    serial.flags = flags;
+
+    return (ioctl(fd, TIOCSSERIAL, &serial) == 0);
+}
+
 bool SerialPort::open(const char *options)
+{
+    return open(options, SerialExtendedOptions());
+}
+
+bool SerialPort::open(const char *options, SerialExtendedOptions const &extended)
 {
     SerialSetting cfg = { };
 
@@ -313,11 +379,17 @@ bool SerialPort::open(const char *options)
         return false;
     }
 
-    if (!parse_options(options, cfg))
+    if (!parse_options(options, cfg, extended.custom_baudrate))
     {
         return false;
     }
 
+    if ((extended.vmin < 0) || (extended.vmin > 255) || (extended.vtime < 0) || (extended.vtime > 255))
+    {
+        slog::warning("invalid serial vmin/vtime: {}/{}", extended.vmin, extended.vtime);
+        return false;
+    }
+
     fd_ = ::open(path_.c_str(), O_NONBLOCK | O_RDWR | O_NOCTTY);
     if (fd_ == -1)
     {
@@ -377,16 +449,17 @@ bool SerialPort::open(const char *options)
         set.c_cflag |= CSTOPB;
     }
 
-    cfsetispeed(&set, cfg.baudrate);
-    cfsetospeed(&set, cfg.baudrate);
+    // 非标准波特率先使用一个标准值，再通过termios2修改
+    cfsetispeed(&set, cfg.baudrate ? cfg.baudrate : B38400);
+    cfsetospeed(&set, cfg.baudrate ? cfg.baudrate : B38400);
 
     // 其他控制位
     set.c_lflag &= ~ICANON;    
     set.c_lflag &= ~ECHO;    
     set.c_lflag &= ~ISIG;
 
-    set.c_cc[VMIN] = 1;    
-    set.c_cc[VTIME] = 0;    
+    set.c_cc[VMIN] = extended.vmin;    
+    set.c_cc[VTIME] = extended.vtime;    
 
     if (tcsetattr(fd_, TCSANOW, &set) != 0)
     {
@@ -396,15 +469,103 @@ bool SerialPort::open(const char *options)
         return false;
     }
 
+    if ((cfg.baudrate == 0) && !termios2::set_baudrate(fd_, cfg.rate))
+    {
+        slog::warning("serial({}) set custom baudrate {} failed", name_, cfg.rate);
+        tcsetattr(fd_, TCSANOW, &default_options_);
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    // 低延时模式，驱动不支持时只给出警告
+    default_serial_flags_ = -1;
+    if (extended.low_latency)
+    {
+        int flags = get_serial_flags(fd_);
+
+        if (flags < 0)
+        {
+            slog::warning("serial({}) does not support ASYNC_LOW_LATENCY: {}", name_, strerror(errno));
+        }
+        else if (!(flags & ASYNC_LOW_LATENCY))
+        {
+            if (set_serial_flags(fd_, flags | ASYNC_LOW_LATENCY))
+            {
+                default_serial_flags_ = flags;
+            }
+            else 
+            {
+                slog::warning("serial({}) set ASYNC_LOW_LATENCY failed: {}", name_, strerror(errno));
+            }
+        }
+    }
+
     // 清空收发缓存 
     tcflush(fd_, TCIOFLUSH);
 
-    slog::debug("serial({}) open success", name_);
+    // 异步发送的唤醒事件
+    tx_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (tx_event_fd_ < 0)
+    {
+        slog::warning("serial({}) eventfd() failed: {}", name_, strerror(errno));
+        tcsetattr(fd_, TCSANOW, &default_options_);
+
+        // 已经打开低延时模式时也要恢复
+        if (default_serial_flags_ >= 0)
+        {
+            set_serial_flags(fd_, default_serial_flags_);
+            default_serial_flags_ = -1;
+        }
+
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    // 记录波特率和每个字符的位数，分帧器使用
+    baudrate_ = cfg.rate;
+    char_bits_ = 1 + cfg.data_bits + ((cfg.parity_odd || cfg.parity_even) ? 1 : 0) + cfg.stop_bits;
+
+    // 从驱动读回实际生效的设置
+    applied_ = { };
+    applied_.baudrate = termios2::get_baudrate(fd_);
+    applied_.custom_baudrate = (cfg.baudrate == 0);
+
+    int flags = get_serial_flags(fd_);
+    applied_.low_latency = (flags >= 0) && (flags & ASYNC_LOW_LATENCY);
+
+    struct termios current;
+    if (tcgetattr(fd_, &current) == 0)
+    {
+        applied_.vmin = current.c_cc[VMIN];
+        applied_.vtime = current.c_cc[VTIME];
+    }
+
+    if ((applied_.baudrate != 0) && (applied_.baudrate != cfg.rate))
+    {
+        slog::warning("serial({}) baudrate {} requested, driver reports {}", name_, cfg.rate, applied_.baudrate);
+    }
+
+    if ((applied_.vmin != extended.vmin) || (applied_.vtime != extended.vtime))
+    {
+        slog::warning("serial({}) vmin/vtime {}/{} requested, driver reports {}/{}", 
+            name_, extended.vmin, extended.vtime, applied_.vmin, applied_.vtime);
+    }
+
+    slog::debug("serial({}) open success, baudrate {}{}, low-latency {}, vmin {}, vtime {}", name_, 
+        applied_.baudrate, applied_.custom_baudrate ? " (custom)" : "", 
+        applied_.low_latency, applied_.vmin, applied_.vtime);
 
     return true;
 }
 
 
+SerialAppliedSettings SerialPort::applied_settings()
+{
+    return applied_;
+}
+
 int SerialPort::get_fd()
 {
     return fd_;
@@ -430,85 +591,96 @@ void SerialPort::close()
             slog::warning("tcsetattr() failed: {}", strerror(errno));
         }
 
+        if ((default_serial_flags_ >= 0) && !set_serial_flags(fd_, default_serial_flags_))
+        {
+            slog::warning("serial({}) restore serial flags failed: {}", name_, strerror(errno));
+        }
+        default_serial_flags_ = -1;
+
         ::close(fd_);
         fd_ = -1;
 
+        ::close(tx_event_fd_);
+        tx_event_fd_ = -1;
+
+        // 丢弃未发送的数据
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+        decltype(tx_queue_)().swap(tx_queue_);
+        tx_offset_ = 0;
+        tx_pending_bytes_ = 0;
+        tx_blocked_ = false;
+
         slog::debug("serial({}) close", name_);
     }
 }
 
-SerialStatistics SerialPort::get_statistics()
-{
-    std::lock_guard<std::mutex> lock(statistics_mutex_);    
-    return statistics_;
-}
-
-
-void SerialPort::flush()
+uint64_t SerialHistogram::count() const
 {
-    if (fd_ != -1)
+    uint64_t total = 0;
+    for (auto n : buckets)
     {
-        tcflush(fd_, TCIOFLUSH);
+        total += n;
     }
+
+    return total;
 }
 
-int SerialPort::read_with_epoll(int fd, int epoll_fd, void *buf, int size, int timeout)
+uint64_t SerialHistogram::percentile(double percent) const
 {
-    if (timeout <= 0)
+    uint64_t total = count();
+    if (total == 0)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        return 0;
+    }
 
-        int ret = ::read(fd, buf, size);
+    // 至少需要覆盖的样本数
+    uint64_t target = static_cast<uint64_t>(total * percent / 100.0 + 0.5);
+    target = std::max<uint64_t>(target, 1);
 
-        if (ret < 0)
+    uint64_t sum = 0;
+    for (int i = 0; i < BucketNum; ++ i)
+    {
+        sum += buckets[i];
+        if (sum >= target)
         {
-            if (errno == EAGAIN)
-            {
-                ret = 0;
-            }
-            //slog::trace("read() errno = {}", errno);
+            return bucket_limit(i);
         }
-
-        return ret;
     }
-    else 
-    {     
-        #define MAX_EVENTS 10        
-        struct epoll_event /*ev,*/ events[MAX_EVENTS];
-        int64_t expired = naiad::system::uptime() + timeout;
-        int offset = 0;
 
-        while ((offset < size) && (timeout > 0))
-        {
-            int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
-            if (nfds < 0)
-            {
-                slog::warning("epoll wait() error");
-                return -1;
-            }
+    return bucket_limit(BucketNum - 1);
+}
 
-            for (int i = 0; i < nfds; ++ i)
-            {
-                if (events[i].data.fd == fd)
-                {
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    int ret = ::read(events[i].data.fd, (unsigned char *)buf + offset, size - offset);
-                    if (ret < 0)
-                    {
-                        return ret;
-                    }
-                    else if (ret > 0)
-                    {
-                        offset += ret;
-                    }
-                }                
-            }
+SerialStatistics SerialPort::get_statistics()
+{
+    SerialStatistics stats;
+
+    // 各项计数独立读取，不保证彼此之间严格一致
+    stats.fifo_size = fifo_size_;
+    stats.fifo_peak_size = fifo_peak_size_.load(std::memory_order_relaxed);
+    stats.rx_bytes = rx_bytes_.load(std::memory_order_relaxed);
+    stats.tx_bytes = tx_bytes_.load(std::memory_order_relaxed);
+    stats.rx_drop_bytes = rx_drop_bytes_.load(std::memory_order_relaxed);
+    stats.rx_frames = rx_frames_num_.load(std::memory_order_relaxed);
+    stats.rx_frame_errors = rx_frame_errors_.load(std::memory_order_relaxed);
+    stats.tx_drop_bytes = tx_drop_bytes_.load(std::memory_order_relaxed);
+
+    rx_chunk_sizes_.load(stats.rx_chunk_sizes);
+    rx_latency_us_.load(stats.rx_latency_us);
+    fifo_usage_.load(stats.fifo_usage);
+
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    stats.tx_pending_bytes = tx_pending_bytes_;
+    stats.tx_rejects = tx_rejects_;
+
+    return stats;
+}
 
-            // 
-            timeout = expired - naiad::system::uptime();
-        }
 
-        return offset;
+void SerialPort::flush()
+{
+    if (fd_ != -1)
+    {
+        tcflush(fd_, TCIOFLUSH);
     }
 }
 
@@ -604,8 +776,7 @@ int SerialPort::read(void *buf, int size, int timeout)
     {        
         slog::trace_data(buf, rx_size, "serial({}) read({}):", name_, rx_size);
 
-        std::lock_guard<std::mutex> lock(statistics_mutex_);
-        statistics_.rx_bytes += rx_size;        
+        rx_bytes_.fetch_add(rx_size, std::memory_order_relaxed);
     }
 
     return rx_size;
@@ -655,239 +826,1139 @@ int SerialPort::write(const void *buf, int size)
         slog::warning("serial({}) write {} bytes, but expect {} bytes", name_, offset, size);
     }
 
-    std::lock_guard<std::mutex> lock(statistics_mutex_);        
-    statistics_.tx_bytes += offset;
+    tx_bytes_.fetch_add(offset, std::memory_order_relaxed);
 
     return offset;
 }
 
 
 /**
- * @brief 启动异步读
+ * @brief 将接收到的一包数据放入接收队列，只在接收线程中调用
  * 
- * @param queue_size 
- * @return true 
- * @return false 
+ * @param buf 
+ * @param size 
  */
-bool SerialPort::async_read_start(int queue_size)
+void SerialPort::rx_input(uint8_t const *buf, int size)
 {
-    if (fd_ < 0)
-    {
-        return false;
-    }
+    rx_bytes_.fetch_add(size, std::memory_order_relaxed);
+    rx_chunk_sizes_.add(size);
 
-    if (rx_thread_running_)
+    std::size_t used;
+    std::size_t fifo_size = fifo_size_;
+    int64_t now_us = naiad::system::uptime_us();
+
+    if (deframer_)
     {
-        slog::warning("serial({}) aync-read is running", name_);
-        return false;
+        // 分帧模式，完整的帧放入帧队列
+        deframer_->input(buf, size, now_us, rx_frame_output_);
+        used = rx_frame_bytes();
     }
+    else 
+    {
+        // 整包拷贝到队列中，放不下的部分丢弃
+        std::size_t pushed = rx_queue_.push(buf, size);
+        used = rx_queue_.size();
 
-    // 清除fifo数据
-    decltype(rx_queue_)().swap(rx_queue_);
-
-    // 设定fifo大小
-    statistics_.fifo_size = queue_size;
-
-    rx_thread_ = std::thread([this]() {
-
-        this->rx_thread_running_ = true;
-        uint8_t buf[1024];
-
-        #if ASYNC_READ_WITH_EPOLL
-        int epoll_fd = epoll_create1(0);
-        if (epoll_fd < 0)
+        if (pushed > 0)
         {
-            slog::error("epoll_create1() failed");
-            return ;
+            rx_stamp(pushed, now_us);
+            rx_ready_ = true;
         }
 
-        struct epoll_event ev;
-        ev.events = EPOLLIN;
-        ev.data.fd = fd_;
-
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd_, &ev) < 0)
+        if (pushed < static_cast<std::size_t>(size))
         {
-            slog::error("epoll_ctl() failed");
-
-            ::close(epoll_fd);
-            return ;
+            rx_drop(size - pushed);
         }
+    }
 
-        #endif // ASYNC_READ_WITH_EPOLL
-
-        while(this->rx_thread_running_)
-        {            
-            // 将数据放入队列中
-            #if ASYNC_READ_WITH_EPOLL
-            int rx_size = read_with_epoll(fd_, epoll_fd, buf, sizeof(buf), 10);
-            #else 
-            int rx_size = read_with_select(fd_, buf, sizeof(buf), 10);
-            #endif 
-            if (rx_size > 0)
-            {   
-                
-                {
-                    std::lock_guard<std::mutex> lock(statistics_mutex_);                             
-                    statistics_.rx_bytes += rx_size;
-                }
-
-                // 将数据放放队列中
-                // 如果接收队列的数据小于设定最大小
-                if (this->rx_queue_.size() < this->statistics_.fifo_size)
-                {
-                    // 加一个锁保护
-                    std::lock_guard<std::mutex> lock(this->rx_queue_mutex_);
-
-                    // 将这一包数据放在队列，多一点没有关系
-                    for (int i = 0; i < rx_size ; ++i)
-                    {
-                        this->rx_queue_.push(buf[i]);
-                    }
-
-                    #if SERIAL_RX_NOTIFY
-                    this->rx_signal_.notify();
-                    #endif 
-
-                    // 计算峰值 
-                    if (this->rx_queue_.size() > this->statistics_.fifo_peak_size)
-                    {    
-                        slog::debug("serial({}) rx fifo peak rise: {} -> {}", this->name_, this->statistics_.fifo_peak_size, this->rx_queue_.size());
-
-                        std::lock_guard<std::mutex> lock(statistics_mutex_); 
-                        this->statistics_.fifo_peak_size = this->rx_queue_.size();
-                    }
-
-                    // 如果到达FIFO的1/2 和 3/4, 给出一条警告， 
-                    if ((!this->rx_queue_three_quarter_alert_) && (this->rx_queue_.size() > ((this->statistics_.fifo_size * 3) / 4)))
-                    {
-                        slog::warning("serial({}) fifo used({}) up to 3/4 of max size", this->name_, this->rx_queue_.size());
-                        this->rx_queue_three_quarter_alert_ = true;
-                    }
-                    else if ((!this->rx_queue_half_alert_) && (this->rx_queue_.size() > (this->statistics_.fifo_size >> 1)))
-                    {
-                        slog::warning("serial({}) fifo used({}) up to 1/2 of max size", this->name_, this->rx_queue_.size());                                
-                        this->rx_queue_half_alert_ = true;
-                    }
-
-                    // FIFO降低后，再次开启警告
-                    if (this->rx_queue_.size() < (this->statistics_.fifo_size >> 1))
-                    {
-                        this->rx_queue_half_alert_ = false;
-                    }
-
-                    if (this->rx_queue_.size() < (this->rx_queue_.size() > ((this->statistics_.fifo_size * 3) / 4)))
-                    {
-                        this->rx_queue_three_quarter_alert_ = false;
-                    }
-
-                    this->rx_queue_full_alert_ = false;
+    fifo_usage_.add(used);
 
-                }
-                else 
-                {
+    // 计算峰值，只有接收线程写入，不需要原子的比较交换
+    uint32_t peak = fifo_peak_size_.load(std::memory_order_relaxed);
+    if (used > peak)
+    {
+        slog::debug("serial({}) rx fifo peak rise: {} -> {}", name_, peak, used);
+        fifo_peak_size_.store(static_cast<uint32_t>(used), std::memory_order_relaxed);
+    }
 
-                    if (!this->rx_queue_full_alert_)
-                    {
-                        slog::warning("serial({}) fifo full, drop {} bytes, more meessage will be subpressed", this->name_, rx_size);
-                        this->rx_queue_full_alert_ = true;
-                    } 
+    // 如果到达FIFO的1/2 和 3/4, 给出一条警告， 
+    if ((!rx_queue_three_quarter_alert_) && (used > ((fifo_size * 3) / 4)))
+    {
+        slog::warning("serial({}) fifo used({}) up to 3/4 of max size", name_, used);
+        rx_queue_three_quarter_alert_ = true;
+    }
+    else if ((!rx_queue_half_alert_) && (used > (fifo_size >> 1)))
+    {
+        slog::warning("serial({}) fifo used({}) up to 1/2 of max size", name_, used);
+        rx_queue_half_alert_ = true;
+    }
 
-                    std::lock_guard<std::mutex> lock(statistics_mutex_); 
-                    statistics_.rx_drop_bytes += rx_size;
-                }
+    // FIFO降低后，再次开启警告，满的警告同样降到1/2以下才再次开启，避免在满的附近反复输出
+    if (used < (fifo_size >> 1))
+    {
+        rx_queue_half_alert_ = false;
+        rx_queue_full_alert_ = false;
+    }
 
-                slog::trace_data(buf, rx_size, "serial({}) read({}):", this->name_, rx_size);
-            } 
-            else 
-            {
-                if (rx_size < 0) 
-                {
-                    slog::warning("serial({}) rx failed,ret={}", this->name_, rx_size);
-                }
-                
-            }           
+    if (used < ((fifo_size * 3) / 4))
+    {
+        rx_queue_three_quarter_alert_ = false;
+    }
 
-            //std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-        }
+    slog::trace_data(buf, size, "serial({}) read({}):", name_, size);
+}
 
-        #if ASYNC_READ_WITH_EPOLL
-        ::close(epoll_fd);
-        #endif 
-    });
+/**
+ * @brief 接收队列已满，丢弃数据
+ * 
+ * @param size 
+ */
+void SerialPort::rx_drop(std::size_t size)
+{
+    if (!rx_queue_full_alert_)
+    {
+        slog::warning("serial({}) fifo full, drop {} bytes, more meessage will be subpressed", name_, size);
+        rx_queue_full_alert_ = true;
+    } 
 
-    return true;
+    rx_drop_bytes_.fetch_add(size, std::memory_order_relaxed);
 }
 
-#if SERIAL_RX_NOTIFY
 /**
- * @brief 启动异步接收，并注册异步通知
+ * @brief 记录一包数据写入接收队列的时间，只在接收线程中调用
  * 
- * @param uv_loop 接收通知的loop
- * @param signal_handle 异步处理函数
- * @param queue_size 队列大小
- * @return bool  
+ * @param pushed 写入的字节数
+ * @param now_us 
  */
-bool SerialPort::async_read_start(uv_loop_t *uv_loop, uv::AsyncSignal::Function signal_handle, int queue_size = 8192)
+void SerialPort::rx_stamp(std::size_t pushed, int64_t now_us)
 {
-    // bind loop
-    rx_signal_.bind(uv_loop, signal_handle);
+    rx_pushed_bytes_ += pushed;
 
-    bool ret = async_read_start(queue_size);
-    if (!ret)
+    uint32_t head = rx_stamp_head_.load(std::memory_order_relaxed);
+    if (head - rx_stamp_tail_.load(std::memory_order_acquire) >= RxStampNum)
     {
-        //接收线程启动失败，关闭信号
-        rx_signal_.close();
+        // 时间戳队列已满，这一包不统计
+        return ;
     }
 
-    return ret;
-}
+    RxStamp &stamp = rx_stamps_[head % RxStampNum];
+    stamp.end = rx_pushed_bytes_;
+    stamp.time_us = now_us;
 
-#endif 
+    rx_stamp_head_.store(head + 1, std::memory_order_release);
+}
 
 /**
- * @brief 停止异步读
+ * @brief 数据从接收队列中取走，统计已完整取走的各包数据的延时，只在读取线程中调用
  * 
+ * @param size 
  */
-void SerialPort::async_read_stop()
+void SerialPort::rx_popped(std::size_t size)
 {
-    if (rx_thread_running_)
+    if (size == 0)
     {
+        return ;
+    }
 
-        #if SERIAL_RX_NOTIFY
-        rx_signal_.close();
-        #endif 
+    rx_popped_bytes_ += size;
 
-        rx_thread_running_ = false;
-        // wait for end
-        rx_thread_.join();
+    uint32_t tail = rx_stamp_tail_.load(std::memory_order_relaxed);
+    uint32_t head = rx_stamp_head_.load(std::memory_order_acquire);
+    int64_t now_us = 0;
+
+    while ((tail != head) && (rx_stamps_[tail % RxStampNum].end <= rx_popped_bytes_))
+    {
+        if (now_us == 0)
+        {
+            now_us = naiad::system::uptime_us();
+        }
+
+        rx_latency_us_.add(now_us - rx_stamps_[tail % RxStampNum].time_us);
+        tail ++;
     }
+
+    rx_stamp_tail_.store(tail, std::memory_order_release);
 }
 
 /**
- * @brief 异步读数据
+ * @brief 分帧器输出一个完整帧，放入帧队列
  * 
- * @param buf 
+ * @param data 
  * @param size 
- * @return int 
  */
-int SerialPort::async_read(void *buf, int size)
+void SerialPort::rx_frame_input(uint8_t const *data, int size)
 {
-    int rx_size = 0;
+    {
+        std::lock_guard<std::mutex> lock(rx_frames_mutex_);
+
+        if (rx_frames_bytes_ + size > fifo_size_)
+        {
+            // 队列已满，丢弃整帧
+            data = nullptr;
+        }
+        else 
+        {
+            rx_frames_.push_back(RxFrame { std::vector<uint8_t>(data, data + size), naiad::system::uptime_us() });
+            rx_frames_bytes_ += size;
+        }
+    }
+
+    if (data == nullptr)
+    {
+        rx_drop(size);
+        return ;
+    }
 
-    unsigned char *data = (unsigned char *)buf;
+    rx_ready_ = true;
 
-    // 加一个锁保护
-    std::lock_guard<std::mutex> lock(rx_queue_mutex_);
+    rx_frames_num_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 返回帧队列中的数据量
+ * 
+ * @return std::size_t 
+ */
+std::size_t SerialPort::rx_frame_bytes()
+{
+    std::lock_guard<std::mutex> lock(rx_frames_mutex_);
+    return rx_frames_bytes_;
+}
 
-    while(!rx_queue_.empty() && (rx_size < size))
+/**
+ * @brief 分帧器的空闲检测
+ * 
+ * @return int64_t 下一次检测的时间点(us), 0 表示不需要
+ */
+int64_t SerialPort::rx_idle_check()
+{
+    if (!deframer_)
     {
-        data[rx_size] = rx_queue_.front();
-        rx_queue_.pop();
+        return 0;
+    }
 
-        ++ rx_size;
+    int64_t deadline = deframer_->idle_deadline();
+    if (deadline > 0)
+    {
+        int64_t now = naiad::system::uptime_us();
+        if (now >= deadline)
+        {
+            deframer_->idle(now, rx_frame_output_);
+            deadline = deframer_->idle_deadline();
+        }
     }
 
-    return rx_size;
+    rx_frame_errors_.store(deframer_->errors(), std::memory_order_relaxed);
+
+    return deadline;
+}
+
+/**
+ * @brief 接收队列中有新数据时，通知使用者
+ * 
+ */
+void SerialPort::rx_notify()
+{
+    if (!rx_ready_)
+    {
+        return ;
+    }
+
+    rx_ready_ = false;
+
+    rx_wait_wakeup(false);
+
+    #if SERIAL_RX_NOTIFY
+    if (rx_poll_running_)
+    {
+        // loop模式下直接调用
+        if (rx_poll_handle_)
+        {
+            rx_poll_handle_(0);
+        }
+    }
+    else 
+    {
+        rx_signal_.notify();
+    }
+    #endif 
+}
+
+/**
+ * @brief 唤醒async_read_wait()
+ * 
+ * @param force 为false时只在队列中的数据达到等待的字节数时唤醒
+ */
+void SerialPort::rx_wait_wakeup(bool force)
+{
+    // 与async_read_wait()中的顺序相反: 先写入队列再检查等待标志，
+    // 两边都使用seq_cst屏障，保证至少有一方能看到对方的修改，不会漏掉唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::size_t wait_size = rx_wait_size_.load(std::memory_order_relaxed);
+
+    if (wait_size == 0)
+    {
+        return ;
+    }
+
+    if (!force && (rx_queue_.size() < wait_size))
+    {
+        return ;
+    }
+
+    // 加锁保证等待的线程已进入休眠或还未检查条件
+    std::lock_guard<std::mutex> lock(rx_wait_mutex_);
+    rx_wait_cond_.notify_one();
+}
+
+/**
+ * @brief 读空串口中的数据，放入接收队列，一次最多读取半个队列
+ * 
+ * @return int 读到的字节数，出错时返回-1
+ */
+int SerialPort::rx_read_available()
+{
+    uint8_t buf[1024];
+    int total = 0;
+
+    while (true)
+    {
+        int ret;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ret = ::read(fd_, buf, sizeof(buf));
+        }
+
+        if (ret > 0)
+        {
+            rx_input(buf, ret);
+            total += ret;
+
+            // 没有读满，说明已读空
+            if (ret < static_cast<int>(sizeof(buf)))
+            {
+                break;
+            }
+
+            // 数据持续到达时，读到半个队列就先返回通知使用者，剩余数据由下一次可读事件处理，
+            // 否则在读空之前队列就可能溢出
+            if (total >= static_cast<int>(fifo_size_ / 2))
+            {
+                break;
+            }
+        }
+        else 
+        {
+            if ((ret < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+
+            if ((ret < 0) && (errno != EAGAIN))
+            {
+                slog::warning("serial({}) rx failed: {}", name_, strerror(errno));
+                return (total > 0) ? total : -1;
+            }
+
+            break;
+        }
+    }
+
+    return total;
+}
+
+/**
+ * @brief 检查异步接收的运行状态，并初始化接收队列
+ * 
+ * @param queue_size 
+ * @return true 
+ * @return false 
+ */
+bool SerialPort::async_read_prepare(int queue_size)
+{
+    if (fd_ < 0)
+    {
+        return false;
+    }
+
+    if (async_running())
+    {
+        slog::warning("serial({}) aync-read is running", name_);
+        return false;
+    }
+
+    // 重新分配fifo, 同时清除fifo数据
+    if (!rx_queue_.reset(queue_size))
+    {
+        slog::warning("serial({}) invalid fifo size: {}", name_, queue_size);
+        return false;
+    }
+
+    // 设定fifo大小
+    fifo_size_ = queue_size;
+
+    // 清除时间戳，此时接收线程还未运行
+    rx_stamp_head_.store(0, std::memory_order_relaxed);
+    rx_stamp_tail_.store(0, std::memory_order_relaxed);
+    rx_pushed_bytes_ = 0;
+    rx_popped_bytes_ = 0;
+
+    // 清除帧队列，并复位分帧器
+    {
+        std::lock_guard<std::mutex> lock(rx_frames_mutex_);
+        decltype(rx_frames_)().swap(rx_frames_);
+        rx_frames_bytes_ = 0;
+    }
+
+    if (deframer_)
+    {
+        deframer_->reset();
+        deframer_->setup(baudrate_, char_bits_);
+    }
+
+    rx_ready_ = false;
+    rx_wait_stopped_ = false;
+
+    // 上次停止时未发送完的数据，唤醒事件可能已被退出的接收线程读走，这里重新唤醒
+    bool tx_remain;
+    {
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+        tx_remain = !tx_queue_.empty();
+    }
+
+    if (tx_remain)
+    {
+        tx_wakeup();
+    }
+
+    return true;
+}
+
+/**
+ * @brief 接收线程，使用epoll同时监听串口的收发和发送唤醒事件
+ * 
+ */
+void SerialPort::rx_thread_loop()
+{
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+    {
+        slog::error("epoll_create1() failed");
+        return ;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd_;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd_, &ev) < 0)
+    {
+        slog::error("epoll_ctl() failed");
+
+        ::close(epoll_fd);
+        return ;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = tx_event_fd_;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tx_event_fd_, &ev) < 0)
+    {
+        slog::error("epoll_ctl() failed");
+
+        ::close(epoll_fd);
+        return ;
+    }
+
+    // 是否在监听可写事件
+    bool tx_waiting = false;
+
+    while (rx_thread_running_)
+    {
+        // 等待时间不超过分帧器的空闲检测时间
+        int timeout = 10;
+        int64_t deadline = rx_idle_check();
+        if (deadline > 0)
+        {
+            int64_t wait = (deadline - naiad::system::uptime_us() + 999) / 1000;
+            timeout = static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(wait, timeout)));
+        }
+
+        struct epoll_event events[2];
+        bool tx_ready = false;
+
+        int nfds = epoll_wait(epoll_fd, events, 2, timeout);
+
+        for (int i = 0; i < nfds; ++ i)
+        {
+            if (events[i].data.fd == fd_)
+            {
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                {
+                    rx_read_available();
+                }
+
+                if (events[i].events & EPOLLOUT)
+                {
+                    tx_ready = true;
+                }
+            }
+            else if (events[i].data.fd == tx_event_fd_)
+            {
+                tx_wakeup_clear();
+                tx_ready = true;
+            }
+        }
+
+        if (tx_ready)
+        {
+            bool pending = tx_drain();
+
+            // 内核缓存满时，监听可写事件，写完后取消
+            if (pending != tx_waiting)
+            {
+                ev.events = pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+                ev.data.fd = fd_;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd_, &ev);
+                tx_waiting = pending;
+            }
+        }
+
+        rx_idle_check();
+        rx_notify();
+    }
+
+    ::close(epoll_fd);
+}
+
+/**
+ * @brief 启动异步发送的唤醒
+ * 
+ */
+void SerialPort::tx_wakeup()
+{
+    uint64_t one = 1;
+    if (::write(tx_event_fd_, &one, sizeof(one)) < 0)
+    {
+        slog::trace("serial({}) tx wakeup failed: {}", name_, strerror(errno));
+    }
+}
+
+/**
+ * @brief 清除发送唤醒事件
+ * 
+ */
+void SerialPort::tx_wakeup_clear()
+{
+    uint64_t count;
+    if (::read(tx_event_fd_, &count, sizeof(count)) < 0)
+    {
+        // 非阻塞，没有事件时返回EAGAIN
+    }
+}
+
+/**
+ * @brief 将发送队列中的数据合并写入串口，只在接收线程(或loop)中调用
+ * 
+ * @return true 队列中还有数据，需要等待串口可写
+ * @return false 队列已空
+ */
+bool SerialPort::tx_drain()
+{
+    int total = 0;
+    bool pending = false;
+    bool writable = false;
+
+    while (true)
+    {
+        struct iovec iov[TX_IOV_MAX];
+        int iov_num = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(tx_mutex_);
+
+            // deque在尾部添加数据时，已有元素的引用不会失效，写入时不需要持有锁
+            std::size_t offset = tx_offset_;
+            for (auto it = tx_queue_.begin(); (it != tx_queue_.end()) && (iov_num < TX_IOV_MAX); ++ it)
+            {
+                iov[iov_num].iov_base = it->data() + offset;
+                iov[iov_num].iov_len = it->size() - offset;
+                iov_num ++;
+                offset = 0;
+            }
+        }
+
+        if (iov_num == 0)
+        {
+            break;
+        }
+
+        ssize_t ret;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ret = ::writev(fd_, iov, iov_num);
+        }
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == EAGAIN)
+            {
+                pending = true;
+                break;
+            }
+
+            // 串口出错，丢弃所有未发送的数据
+            slog::warning("serial({}) writev() failed: {}", name_, strerror(errno));
+
+            std::size_t drop;
+            {
+                std::lock_guard<std::mutex> lock(tx_mutex_);
+                drop = tx_pending_bytes_;
+                decltype(tx_queue_)().swap(tx_queue_);
+                tx_offset_ = 0;
+                tx_pending_bytes_ = 0;
+                writable = tx_blocked_;
+                tx_blocked_ = false;
+            }
+
+            tx_drop_bytes_.fetch_add(drop, std::memory_order_relaxed);
+            break;
+        }
+
+        // 移除已写完的缓存
+        {
+            std::lock_guard<std::mutex> lock(tx_mutex_);
+
+            std::size_t written = ret;
+            tx_pending_bytes_ -= written;
+
+            while (written > 0)
+            {
+                std::size_t remain = tx_queue_.front().size() - tx_offset_;
+                if (written >= remain)
+                {
+                    written -= remain;
+                    tx_queue_.pop_front();
+                    tx_offset_ = 0;
+                }
+                else 
+                {
+                    tx_offset_ += written;
+                    written = 0;
+                }
+            }
+
+            // 低于低水位后，解除反压
+            if (tx_blocked_ && (tx_pending_bytes_ <= tx_low_watermark_))
+            {
+                tx_blocked_ = false;
+                writable = true;
+            }
+        }
+
+        total += ret;
+    }
+
+    if (total > 0)
+    {
+        tx_bytes_.fetch_add(total, std::memory_order_relaxed);
+    }
+
+    if (tx_callback_ && ((total > 0) || writable))
+    {
+        tx_callback_(total);
+    }
+
+    return pending;
+}
+
+/**
+ * @brief 启动异步读
+ * 
+ * @param queue_size 
+ * @return true 
+ * @return false 
+ */
+bool SerialPort::async_read_start(int queue_size)
+{
+    if (!async_read_prepare(queue_size))
+    {
+        return false;
+    }
+
+    // 在线程启动前置位，保证随后的async_read_stop()能等待线程退出
+    rx_thread_running_ = true;
+
+    rx_thread_ = std::thread(&SerialPort::rx_thread_loop, this);
+
+    return true;
+}
+
+#if SERIAL_RX_NOTIFY
+/**
+ * @brief 启动异步接收，并注册异步通知
+ * 
+ * @param uv_loop 接收通知的loop
+ * @param signal_handle 异步处理函数
+ * @param queue_size 队列大小
+ * @return bool  
+ */
+bool SerialPort::async_read_start(uv_loop_t *uv_loop, uv::AsyncSignal::Function signal_handle, int queue_size = 8192)
+{
+    // bind loop
+    rx_signal_.bind(uv_loop, signal_handle);
+
+    bool ret = async_read_start(queue_size);
+    if (!ret)
+    {
+        //接收线程启动失败，关闭信号
+        rx_signal_.close();
+    }
+
+    return ret;
+}
+
+/**
+ * @brief 启动异步接收，串口直接注册到指定loop中，不创建接收线程
+ * 
+ * @param uv_loop 监听串口的loop
+ * @param signal_handle 接收到数据后在loop中直接调用
+ * @param queue_size 队列大小
+ * @return bool  
+ */
+bool SerialPort::async_poll_start(uv_loop_t *uv_loop, uv::AsyncSignal::Function signal_handle, int queue_size)
+{
+    if (!async_read_prepare(queue_size))
+    {
+        return false;
+    }
+
+    rx_poll_handle_ = signal_handle;
+
+    bool ret = rx_poll_.bind(uv_loop, fd_, [this](int status, int events) {
+
+        if (status < 0)
+        {
+            slog::warning("serial({}) poll failed: {}", name_, uv_strerror(status));
+            return ;
+        }
+
+        if (events & UV_READABLE)
+        {
+            // 数据直接在loop中读取并处理，不需要再经过异步通知
+            rx_read_available();
+            rx_notify();
+            rx_idle_timer_start();
+        }
+
+        if (events & UV_WRITABLE)
+        {
+            // 发送完成后，取消可写事件的监听
+            if (!tx_drain())
+            {
+                rx_poll_.start(UV_READABLE);
+            }
+        }
+    });
+
+    // 其他线程写入发送队列时，通过eventfd唤醒loop
+    ret = ret && tx_wakeup_poll_.bind(uv_loop, tx_event_fd_, [this](int status, [[maybe_unused]] int events) {
+
+        if (status < 0)
+        {
+            return ;
+        }
+
+        tx_wakeup_clear();
+
+        if (tx_drain())
+        {
+            rx_poll_.start(UV_READABLE | UV_WRITABLE);
+        }
+    });
+
+    if (!ret || !rx_poll_.start(UV_READABLE) || !tx_wakeup_poll_.start(UV_READABLE))
+    {
+        slog::error("serial({}) start poll failed", name_);
+        rx_poll_.close();
+        tx_wakeup_poll_.close();
+        rx_poll_handle_ = nullptr;
+        return false;
+    }
+
+    if (deframer_)
+    {
+        rx_idle_timer_.bind(uv_loop);
+    }
+
+    rx_poll_running_ = true;
+
+    slog::debug("serial({}) async read on loop", name_);
+
+    return true;
+}
+
+/**
+ * @brief loop模式下，按分帧器的空闲检测时间启动定时器
+ * 
+ */
+void SerialPort::rx_idle_timer_start()
+{
+    int64_t deadline = rx_idle_check();
+
+    if (deadline <= 0)
+    {
+        return ;
+    }
+
+    int64_t wait = (deadline - naiad::system::uptime_us() + 999) / 1000;
+
+    // 单次定时，需要先停止才能重新设定延时
+    rx_idle_timer_.stop();
+    rx_idle_timer_.start(static_cast<int>(std::max<int64_t>(wait, 0)), 0, [this]() {
+        rx_idle_timer_start();
+        rx_notify();
+    });
+}
+
+#endif 
+
+/**
+ * @brief 停止异步读
+ * 
+ */
+void SerialPort::async_read_stop()
+{
+    if (rx_hub_)
+    {
+        // 从hub中移除后，不会再有接收处理
+        rx_hub_->remove(*this);
+    }
+
+    #if SERIAL_RX_NOTIFY
+    if (rx_poll_running_)
+    {
+        rx_poll_.close();
+        tx_wakeup_poll_.close();
+        rx_idle_timer_.close();
+        rx_poll_handle_ = nullptr;
+        rx_poll_running_ = false;
+    }
+    #endif 
+
+    if (rx_thread_running_)
+    {
+
+        #if SERIAL_RX_NOTIFY
+        rx_signal_.close();
+        #endif 
+
+        rx_thread_running_ = false;
+        // 唤醒接收线程，让它尽快退出
+        tx_wakeup();
+        // wait for end
+        rx_thread_.join();
+    }
+
+    // 唤醒正在等待数据的线程
+    rx_wait_stopped_ = true;
+    rx_wait_wakeup(true);
+}
+
+/**
+ * @brief 异步收发是否在运行
+ * 
+ * @return true 
+ * @return false 
+ */
+bool SerialPort::async_running()
+{
+    bool running = rx_thread_running_ || (rx_hub_ != nullptr);
+    #if SERIAL_RX_NOTIFY
+    running = running || rx_poll_running_;
+    #endif 
+
+    return running;
+}
+
+/**
+ * @brief 异步读数据
+ * 
+ * @param buf 
+ * @param size 
+ * @return int 
+ */
+int SerialPort::async_read(void *buf, int size)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+    std::size_t ret = rx_queue_.pop(buf, size);
+    rx_popped(ret);
+
+    return static_cast<int>(ret);
+}
+
+/**
+ * @brief 等待接收队列中的数据足够后再读取
+ * 
+ * @param buf 
+ * @param size 
+ * @param min_size 
+ * @param timeout ms
+ * @return int 
+ */
+int SerialPort::async_read_wait(void *buf, int size, int min_size, int timeout)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+    if (deframer_ || rx_wait_stopped_)
+    {
+        return -1;
+    }
+
+    std::size_t wait_size = static_cast<std::size_t>(std::max(1, std::min(min_size, size)));
+
+    // 数据已足够时不加锁
+    if (rx_queue_.size() < wait_size)
+    {
+        auto ready = [this, wait_size]() {
+            return (rx_queue_.size() >= wait_size) || rx_wait_stopped_;
+        };
+
+        std::unique_lock<std::mutex> lock(rx_wait_mutex_);
+
+        // 先设置等待标志再检查队列，与rx_wait_wakeup()配对
+        rx_wait_size_.store(wait_size, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (timeout < 0)
+        {
+            rx_wait_cond_.wait(lock, ready);
+        }
+        else 
+        {
+            rx_wait_cond_.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+        }
+
+        rx_wait_size_.store(0, std::memory_order_relaxed);
+    }
+
+    return async_read(buf, size);
+}
+
+
+/**
+ * @brief 设置异步发送的高低水位
+ * 
+ * @param high 
+ * @param low 
+ */
+void SerialPort::set_write_watermark(int high, int low)
+{
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+
+    tx_high_watermark_ = (high > 0) ? high : 1;
+    tx_low_watermark_ = ((low >= 0) && (low < high)) ? low : (tx_high_watermark_ / 2);
+}
+
+/**
+ * @brief 设置异步发送回调函数
+ * 
+ * @param callback 
+ */
+void SerialPort::set_write_callback(WriteCallback callback)
+{
+    tx_callback_ = callback;
+}
+
+/**
+ * @brief 异步发送是否可以继续写入
+ * 
+ * @return true 
+ * @return false 
+ */
+bool SerialPort::async_writable()
+{
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    return !tx_blocked_;
+}
+
+/**
+ * @brief 异步写入数据
+ * 
+ * @param buf 
+ * @param size 
+ * @return int 
+ */
+int SerialPort::async_write(const void *buf, int size)
+{
+    if ((buf == nullptr) || (size <= 0))
+    {
+        return 0;
+    }
+
+    uint8_t const *data = static_cast<uint8_t const *>(buf);
+    return async_write(std::vector<uint8_t>(data, data + size));
+}
+
+/**
+ * @brief 异步写入数据，转移缓存的所有权
+ * 
+ * @param data 
+ * @return int 
+ */
+int SerialPort::async_write(std::vector<uint8_t> &&data)
+{
+    if ((fd_ < 0) || !async_running())
+    {
+        return -1;
+    }
+
+    int size = static_cast<int>(data.size());
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    bool wakeup;
+
+    {
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+
+        if (tx_blocked_)
+        {
+            // 超过高水位，等待发送降到低水位
+            tx_rejects_ ++;
+            return 0;
+        }
+
+        // 队列为空时才需要唤醒，否则发送过程会继续处理新数据
+        wakeup = tx_queue_.empty();
+
+        tx_queue_.emplace_back(std::move(data));
+        tx_pending_bytes_ += size;
+
+        if (tx_pending_bytes_ >= tx_high_watermark_)
+        {
+            tx_blocked_ = true;
+        }
+    }
+
+    slog::trace("serial({}) queue tx {} bytes", name_, size);
+
+    if (wakeup)
+    {
+        tx_wakeup();
+    }
+
+    return size;
+}
+
+/**
+ * @brief 设置接收分帧器
+ * 
+ * @param deframer 
+ * @return true 
+ * @return false 
+ */
+bool SerialPort::set_deframer(std::unique_ptr<SerialDeframer> deframer)
+{
+    if (async_running())
+    {
+        slog::warning("serial({}) set deframer failed, aync-read is running", name_);
+        return false;
+    }
+
+    if (deframer && !deframer->is_valid())
+    {
+        slog::warning("serial({}) set deframer failed, invalid config", name_);
+        return false;
+    }
+
+    deframer_ = std::move(deframer);
+
+    return true;
+}
+
+/**
+ * @brief 从帧队列中读取一个完整帧
+ * 
+ * @param frame 
+ * @return true 
+ * @return false 
+ */
+bool SerialPort::async_read_frame(std::vector<uint8_t> &frame)
+{
+    std::lock_guard<std::mutex> lock(rx_frames_mutex_);
+
+    if (rx_frames_.empty())
+    {
+        return false;
+    }
+
+    RxFrame &front = rx_frames_.front();
+    rx_latency_us_.add(naiad::system::uptime_us() - front.time_us);
+
+    frame.swap(front.data);
+    rx_frames_.pop_front();
+    rx_frames_bytes_ -= frame.size();
+
+    return true;
+}
+
+/**
+ * @brief 返回帧队列中的帧数量
+ * 
+ * @return int 
+ */
+int SerialPort::async_frames_num()
+{
+    std::lock_guard<std::mutex> lock(rx_frames_mutex_);
+    return static_cast<int>(rx_frames_.size());
+}
+
+/**
+ * @brief 不拷贝地查看接收队列中的数据
+ * 
+ * @param first 
+ * @param second 
+ * @return int 
+ */
+int SerialPort::peek(ByteRingBuffer::Span &first, ByteRingBuffer::Span &second)
+{
+    return static_cast<int>(rx_queue_.peek(first, second));
+}
+
+/**
+ * @brief 从接收队列中丢弃已处理的数据
+ * 
+ * @param size 
+ * @return int 
+ */
+int SerialPort::consume(int size)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+    std::size_t ret = rx_queue_.consume(size);
+    rx_popped(ret);
+
+    return static_cast<int>(ret);
 }
 
 
@@ -0,0 +1,71 @@
+
+/**
+ * @file serial_termios2.cpp
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 使用termios2设置任意波特率
+ * @version 0.1
+ * @date 2023-06-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <cstring>
+
+#include <common/logger.h>
+
+#include "serial_termios2.h"
+
+namespace naiad
+{
+
+namespace driver
+{
+
+namespace termios2
+{
+
+bool set_baudrate(int fd, int rate)
+{
+    struct ::termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+    {
+        slog::warning("ioctl(TCGETS2) failed: {}", strerror(errno));
+        return false;
+    }
+
+    // 输入和输出使用相同的波特率
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = rate;
+    tio.c_ospeed = rate;
+
+    if (ioctl(fd, TCSETS2, &tio) < 0)
+    {
+        slog::warning("ioctl(TCSETS2) failed: {}", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+int get_baudrate(int fd)
+{
+    struct ::termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+    {
+        return 0;
+    }
+
+    return static_cast<int>(tio.c_ospeed);
+}
+
+} // termios2
+
+} // driver
+
+} // end naiad
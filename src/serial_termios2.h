@@ -0,0 +1,49 @@
+#ifndef __NAIAD_SERIAL_TERMIOS2_H__
+#define __NAIAD_SERIAL_TERMIOS2_H__
+
+/**
+ * @file serial_termios2.h
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief termios2 相关的操作，内部使用
+ * @version 0.1
+ * @date 2023-06-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   <asm/termbits.h> 与 <termios.h> 中的定义冲突，不能在同一个文件中包含，
+ *   因此单独放在 serial_termios2.cpp 中实现
+ */
+
+namespace naiad
+{
+namespace driver
+{
+namespace termios2
+{
+
+/**
+ * @brief 通过BOTHER设置任意波特率，其他参数保持不变
+ *
+ * @param fd
+ * @param rate
+ * @return true
+ * @return false
+ */
+bool set_baudrate(int fd, int rate);
+
+/**
+ * @brief 读取驱动实际使用的输出波特率
+ *
+ * @param fd
+ * @return int 失败时返回0
+ */
+int get_baudrate(int fd);
+
+} // termios2
+
+} // driver
+
+} // naiad
+
+#endif // __NAIAD_SERIAL_TERMIOS2_H__
@@ -12,14 +12,21 @@
  * 
  */
 #include <string>
+#include <cstring>
+#include <chrono>
 #include <thread>
 #include <memory>
+#include <deque>
 #include <algorithm>
 
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <common/logger.h>
 #include <common/sys_time.h>
+#include <common/mpsc_queue.h>
 #include <common/tcp_server.h>
 
 namespace naiad 
@@ -39,6 +46,16 @@ const Host TcpServer::AllClients {"", 0};
 const uv::AsyncSignal::SignalId TcpServer::SignalReceiveFrame(0);
 const uv::AsyncSignal::SignalId TcpServer::SignalConnectionLost(1);
 
+/// 接收的数据不少于缓存块的 1/RX_ADOPT_DIVISOR 时，不复制，帧直接持有缓存
+#define RX_ADOPT_DIVISOR   8
+
+/// 每次发送通知最多处理的帧数量
+#define TX_DRAIN_MAX       1024
+
+/// 连接id的低位为分片序号，最多SHARD_MAX个分片
+#define SHARD_BITS         5
+#define SHARD_MAX          (1 << SHARD_BITS)
+
 
 /**
  * @brief TCP 连接对象
@@ -57,24 +74,31 @@ class TcpConnection
 public:
 
     /// 事件类型
-    enum class Event : int {ReadAvailable = 0, ConnectionLost};
+    enum class Event : int {ReadAvailable = 0, ConnectionLost, WriteComplete};
 
-    /// 事件回调函数 
-    typedef std::function<void(TcpConnection &, Event, uint8_t const * const , int)> EventHandle;
+    /// 事件回调函数，接收到的数据在缓存中的offset处，处理函数可以复制缓存的引用
+    typedef std::function<void(TcpConnection &, Event, SharedBuffer &, int size, int offset)> EventHandle;
 
     /**
      * @brief 创建一个TCP连接
      * 
-     * @param server 
+     * @param loop 
+     * @param id 连接id，由服务端分配
+     * @param pool 接收缓存池
+     * @param framer 分帧配置，属于服务端，为nullptr时不分帧
+     * @param handle 
      */
-    TcpConnection(uv_loop_t *loop, EventHandle handle) : address_(""), event_handle_(handle)
+    TcpConnection(uv_loop_t *loop, uint32_t id, BufferPool &pool, TcpFramerConfig const *framer, EventHandle handle) : 
+        host_{"", 0, id}, pool_(&pool), framer_(framer), event_handle_(handle)
     {
         // 先初始化一个TCP连接
-        uv_tcp_init(loop, &client_);
+        // 句柄单独分配，在uv_close()的回调中释放，连接对象可以先于句柄析构
+        client_ = new uv_tcp_t;
+        uv_tcp_init(loop, client_);
 
         /// 设置对象数据？
         //uv_handle_set_data((uv_handle_t *)&client_, this);
-        client_.data = this;
+        client_->data = this;
     }
 
     /**
@@ -102,7 +126,7 @@ public:
             return false;
         }
 
-        int ret = uv_accept((uv_stream_t *)&server, (uv_stream_t *)&client_);
+        int ret = uv_accept((uv_stream_t *)&server, (uv_stream_t *)client_);
         if (ret != 0)
         {
             connected_ = false;
@@ -116,11 +140,11 @@ public:
         // set tcp optoins
         {
             // enable 
-            int ret = uv_tcp_nodelay(&client_, 1);
+            int ret = uv_tcp_nodelay(client_, 1);
             slog::trace("{}: uv_tcp_nodelay() return {}", server_name, ret);
 
             // KeepAlive 时间 TODO
-            ret = uv_tcp_keepalive(&client_, 1, 10);
+            ret = uv_tcp_keepalive(client_, 1, 10);
             slog::trace("{}: uv_tcp_keepalive() return {}", server_name, ret);
         }
 
@@ -130,16 +154,46 @@ public:
         slog::debug("{}: connection({}) accept success", server_name, brief());
 
         // 启动读函数
-        uv_read_start((uv_stream_t*)&client_, []([[maybe_unused]]uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {            
-            // 申请空间
-            buf->base = (char *)malloc(suggested_size);
-            buf->len = suggested_size;
+        read_start();
+
+        return true;
+
+    }
+
+    /**
+     * @brief 开始读取，暂停读取后调用可以恢复
+     * 
+     */
+    void read_start()
+    {
+        read_paused_ = false;
+        uv_read_start((uv_stream_t*)client_, [](uv_handle_t *handle, [[maybe_unused]]size_t suggested_size, uv_buf_t *buf) {            
+            auto conn = static_cast<TcpConnection*>(handle->data);
+
+            // 有未完成的消息时，接着读到同一块缓存中
+            if (!conn->rx_buffer_.empty())
+            {
+                buf->base = (char *)conn->rx_buffer_.data() + conn->rx_end_;
+                buf->len = conn->pool_->block_size() - conn->rx_end_;
+                return ;
+            }
+
+            // 从缓存池中申请空间，失败时长度为0，libuv将返回UV_ENOBUFS
+            buf->base = (char *)conn->pool_->allocate();
+            buf->len = buf->base ? conn->pool_->block_size() : 0;
 
         }, [](uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
             
             // 获得连接实例
             auto conn = static_cast<TcpConnection*>(stream->data);
 
+            // 接管新分配的缓存，处理函数没有复制引用时，退出时归还到缓存池
+            SharedBuffer buffer;
+            if (conn->rx_buffer_.empty())
+            {
+                buffer = SharedBuffer::adopt((uint8_t *)buf->base);
+            }
+
             // 如果有回调函数
             // 调用服务端的数据处理函数
             if (nread > 0)
@@ -147,54 +201,91 @@ public:
                 //slog::trace("receive {} bytes from ({}): {:X}", nread, conn->brief(), spdlog::to_hex((const unsigned char *)buf->base, (const unsigned char *)buf->base + nread, 16));                
                 slog::trace_data(buf->base, nread, "receive {} bytes from ({}):", nread, conn->brief());
 
-
-                if (conn->event_handle_)
+                if (conn->framer_ == nullptr)
                 {
-                    conn->event_handle_(*conn, Event::ReadAvailable, (unsigned char *)buf->base,  static_cast<int>(nread));
-                }
-            }
-            else 
-            {
-                conn->connected_ = false;
-                conn->down_time_ = naiad::system::uptime();
+                    if (conn->event_handle_)
+                    {
+                        conn->event_handle_(*conn, Event::ReadAvailable, buffer, static_cast<int>(nread), 0);
+                    }
 
-                if (nread == UV_EOF)
-                {
-                    slog::debug("tcp client({}) connection lost", conn->brief());
+                    return ;
                 }
-                else 
-                {
-                    // client read error ?
-                    slog::error("tcp client({}) read failed, ret={}", conn->brief(), uv_strerror(nread));
-                }
-                
-                if (conn->event_handle_)
+
+                if (conn->read_frames(buffer, static_cast<int>(nread)))
                 {
-                    conn->event_handle_(*conn, Event::ConnectionLost, nullptr, 0);
+                    return ;
                 }
+
+                // 分帧错误时数据流已无法同步，断开连接
+                nread = UV_EPROTO;
             }
 
-            // 释放空间
-            free(buf->base); 
+            conn->connected_ = false;
+            conn->down_time_ = naiad::system::uptime();
+
+            if (nread == UV_EOF)
+            {
+                slog::debug("tcp client({}) connection lost", conn->brief());
+            }
+            else 
+            {
+                // client read error ?
+                slog::error("tcp client({}) read failed, ret={}", conn->brief(), uv_strerror(nread));
+            }
+            
+            if (conn->event_handle_)
+            {
+                // 连接可能在处理函数中被删除，之后不能再访问conn
+                conn->event_handle_(*conn, Event::ConnectionLost, buffer, 0, 0);
+            }
         });
+    }
 
-        return true;
+    /**
+     * @brief 暂停读取，数据留在内核缓存中，由TCP窗口让对端降速
+     * 
+     */
+    void read_pause()
+    {
+        if (connected_ && !read_paused_)
+        {
+            uv_read_stop((uv_stream_t *)client_);
+            read_paused_ = true;
+        }
+    }
 
+    /// 是否已暂停读取
+    bool is_read_paused() const
+    {
+        return read_paused_;
     }
 
+
     /**
      * @brief 关闭连接
      * 
      */
     void close()
     {
+        if (closed_)
+        {
+            return ;
+        }
+
         if (connected_)
         {
-            uv_read_stop((uv_stream_t *)&client_);
+            uv_read_stop((uv_stream_t *)client_);
             connected_ = false;
+            down_time_ = naiad::system::uptime();
         }
 
-        uv_close((uv_handle_t *)&client_, nullptr);
+        // 未完成的写请求会以UV_ECANCELED回调，此时连接对象可能已析构，清空data通知它们
+        client_->data = nullptr;
+        uv_close((uv_handle_t *)client_, [](uv_handle_t *handle) {
+                delete reinterpret_cast<uv_tcp_t *>(handle);
+            });
+
+        closed_ = true;
     }
 
     /**
@@ -202,9 +293,15 @@ public:
      * 
      * @return std::string 
      */
-    std::string const brief() const
+    std::string const & brief() const
+    {
+        return brief_;
+    }
+
+    /// 返回连接id
+    uint32_t id() const
     {
-        return address_ + ":" + std::to_string(port_);
+        return host_.id;
     }
 
     /**
@@ -220,33 +317,50 @@ public:
 
     std::string const & get_address() const 
     {
-        return address_;
+        return host_.address;
     }
 
     int get_port() const 
     {
-        return port_;
+        return host_.port;
     }
 
     /**
-     * @brief 返回一个主机对象
+     * @brief 返回一个主机对象，包含连接id
      * 
-     * @return Host const 
+     * @return Host const &
      */
-    Host const get_host() const 
+    Host const & get_host() const 
     {
-        return Host{address_, port_};
+        return host_;
     }
 
     /**
-     * @brief 获取客户端信息
+     * @brief 关联一个客户端信息，之后由sync_client_info()更新
      * 
      * @param info 
      */
-    void update_client_info(ClientInfo &info)
+    void attach_client_info(ClientInfo &info)
+    {
+        client_info_ = &info;
+        sync_client_info();
+    }
+
+    /**
+     * @brief 更新关联的客户端信息
+     * 
+     */
+    void sync_client_info()
     {
-        info.address = address_;
-        info.port = port_;
+        if (client_info_ == nullptr)
+        {
+            return ;
+        }
+
+        ClientInfo &info = *client_info_;
+        info.address = host_.address;
+        info.port = host_.port;
+        info.id = host_.id;
         info.up_time = up_time_;
         info.down_time = down_time_;
         info.connected = connected_;
@@ -255,68 +369,330 @@ public:
     /**
      * @brief 发送数据到客户端
      * 
-     * @param data 数据 
-     * @param size 长度
+     * @param payload 共享数据，写请求持有一个引用，直到写完成
      * @return int 
      */
-    int send(const uint8_t * const data, int size)
+    int send(SharedPayload const &payload)
+    {
+        queue(payload);
+        return flush();
+    }
+
+    /**
+     * @brief 将数据加入待发送列表，调用flush()时一起发送
+     * 
+     * @param payload 
+     */
+    void queue(SharedPayload const &payload)
+    {
+        if (connected_ && !payload.empty())
+        {
+            tx_batch_.push_back(payload);
+            tx_batch_bytes_ += payload.size();
+        }
+    }
+
+    /**
+     * @brief 将一帧的所有分段加入待发送列表，各段在同一个uv_write中连续写出
+     * 
+     * @param segments 
+     * @param count 
+     */
+    void queue(SharedPayload const *segments, int count)
     {
-        if (connected_ && data && (size > 0))
+        for (int i = 0; i < count; ++ i)
         {
-            uv_write_t *req = new uv_write_t;
-            uv_buf_t buf = uv_buf_init((char *)data, size);
+            queue(segments[i]);
+        }
+    }
 
-            slog::trace_data(data, size, "send {} bytes to ({}):", size, brief());
+    /**
+     * @brief 返回未写出的字节数，包括libuv的写队列和待发送列表
+     * 
+     * @return std::size_t 
+     */
+    std::size_t write_queue_size() const
+    {
+        return uv_stream_get_write_queue_size((uv_stream_t const *)client_) + tx_batch_bytes_;
+    }
 
-            int ret = uv_write(req, (uv_stream_t *)&client_, &buf, 1, [](uv_write_t *req, int status){
-                    if (status < 0)
-                    {
-                        slog::warning("{uv_write() callback error:{}", uv_strerror(status));
-                    }
+    /// 是否处于发送拥塞状态
+    bool is_congested() const
+    {
+        return congested_;
+    }
 
-                    // 删除uv_write
-                    delete req;
-                });
+    void set_congested(bool congested)
+    {
+        congested_ = congested;
+    }
+
+    /**
+     * @brief 拥塞时缓存一帧，缓存超过限制时丢弃最早的帧
+     * 
+     * @param segments 帧的所有分段，丢弃时整帧丢弃
+     * @param count 
+     * @param limit 缓存的最大字节数
+     * @return int 丢弃的帧数量
+     */
+    int backlog(SharedPayload const *segments, int count, std::size_t limit)
+    {
+        int dropped = 0;
+
+        if (!connected_ || (count <= 0))
+        {
+            return 0;
+        }
+
+        for (int i = 0; i < count; ++ i)
+        {
+            tx_backlog_.push_back(segments[i]);
+            tx_backlog_bytes_ += segments[i].size();
+        }
+        tx_backlog_frames_.push_back(count);
+
+        while ((tx_backlog_bytes_ > limit) && !tx_backlog_frames_.empty())
+        {
+            for (int i = tx_backlog_frames_.front(); i > 0; -- i)
+            {
+                tx_backlog_bytes_ -= tx_backlog_.front().size();
+                tx_backlog_.pop_front();
+            }
 
-            slog::trace("{}: uv_write(size={}) return {}", brief(), size, ret);
-            return ret;
+            tx_backlog_frames_.pop_front();
+            dropped ++;
         }
 
-        return 0;
+        return dropped;
     }
 
     /**
-     * @brief 发送一个数据帧
+     * @brief 将拥塞时缓存的帧移入待发送列表
      * 
-     * @param frame 
-     * @return int 
      */
-    int send(DataFrame const &frame)
+    void release_backlog()
+    {
+        for (auto &payload : tx_backlog_)
+        {
+            queue(payload);
+        }
+
+        tx_backlog_.clear();
+        tx_backlog_frames_.clear();
+        tx_backlog_bytes_ = 0;
+    }
+
+    /**
+     * @brief 使用一个uv_write发送所有待发送的数据
+     * 
+     * @return int uv_write()的返回值
+     */
+    int flush()
     {
-        if (frame.is_empty())
+        if (tx_batch_.empty())
         {
             return 0;
         }
 
-        return send(frame.data_pointer(), frame.size());        
+        WriteRequest *request = new WriteRequest;
+        request->payloads.swap(tx_batch_);
+        tx_batch_bytes_ = 0;
+
+        std::size_t size = 0;
+        tx_bufs_.clear();
+        for (auto const &payload : request->payloads)
+        {
+            slog::trace_data(payload.data(), payload.size(), "send {} bytes to ({}):", payload.size(), brief());
+
+            tx_bufs_.push_back(uv_buf_init((char *)payload.data(), payload.size()));
+            size += payload.size();
+        }
+
+        // libuv会复制uv_buf_t数组，tx_bufs_可以复用
+        int ret = uv_write(&request->req, (uv_stream_t *)client_, tx_bufs_.data(), tx_bufs_.size(), [](uv_write_t *req, int status){
+                if ((status < 0) && (status != UV_ECANCELED))
+                {
+                    slog::warning("uv_write() callback error:{}", uv_strerror(status));
+                }
+
+                // 连接已关闭时data为空，req在写请求删除后不能再访问
+                auto conn = static_cast<TcpConnection *>(req->handle->data);
+
+                // 删除写请求，同时释放数据的引用
+                delete static_cast<WriteRequest *>(req->data);
+
+                if (conn && conn->event_handle_)
+                {
+                    SharedBuffer none;
+                    conn->event_handle_(*conn, Event::WriteComplete, none, status, 0);
+                }
+            });
+
+        if (ret != 0)
+        {
+            // 失败时不会调用回调函数
+            delete request;
+        }
+
+        slog::trace("{}: uv_write(bufs={}, size={}) return {}", brief(), tx_bufs_.size(), size, ret);
+        return ret;
     }
 
 private:
+    /// 一个写请求，持有发送数据的引用
+    struct WriteRequest
+    {
+        WriteRequest()
+        {
+            req.data = this;
+        }
+
+        uv_write_t req;
+        std::vector<SharedPayload> payloads;
+    };
+
+    /// 待发送的数据，flush()时一次写出
+    std::vector<SharedPayload> tx_batch_;
+    std::size_t tx_batch_bytes_ = 0;
+    /// 发送拥塞状态
+    bool congested_ = false;
+    /// DropOldest策略时，拥塞期间缓存的帧
+    std::deque<SharedPayload> tx_backlog_;
+    /// 缓存中每帧的分段数量
+    std::deque<int> tx_backlog_frames_;
+    std::size_t tx_backlog_bytes_ = 0;
+    /// 发送时使用的uv_buf_t数组
+    std::vector<uv_buf_t> tx_bufs_;
+
     /// 连接对象
-    uv_tcp_t client_;
+    uv_tcp_t *client_;
     /// 连接状态
     bool connected_ = false;
-    // 连接地址
-    std::string address_;
-    // 连接端口
-    int port_ = 0;
+    /// 是否已调用uv_close()
+    bool closed_ = false;
+    /// 是否已暂停读取
+    bool read_paused_ = false;
+    // 连接地址、端口及id
+    Host host_;
+    // 连接简称，用于日志
+    std::string brief_;
+    // 关联的客户端信息，属于服务端
+    ClientInfo *client_info_ = nullptr;
 
     naiad::system::SysTick up_time_;
     naiad::system::SysTick down_time_;
+
+    /// 接收缓存池，属于服务端
+    BufferPool *pool_;
+
+    /// 分帧配置，属于服务端
+    TcpFramerConfig const *framer_;
+    /// 分帧时正在拼接的缓存，未完成的消息在[rx_start_, rx_end_)
+    SharedBuffer rx_buffer_;
+    std::size_t rx_start_ = 0;
+    std::size_t rx_end_ = 0;
     
     /// 事件处理函数
     EventHandle event_handle_;
 
+    /**
+     * @brief 分帧时处理读到的数据，在缓存中原地拼接，只输出完整的消息
+     * 
+     * @param buffer 新分配的缓存，接着rx_buffer_读取时为空
+     * @param size 读到的字节数
+     * @return true 
+     * @return false 长度非法或者无法分配缓存
+     * 
+     * @note 消息直接引用缓存中的数据，不复制；未完成的消息在缓存尾部放不下时移到缓存头部
+     */
+    bool read_frames(SharedBuffer &buffer, int size)
+    {
+        TcpFramerConfig const &config = *framer_;
+        std::size_t const header_size = config.length_offset + config.length_size;
+        std::size_t const max_size = config.max_size;
+
+        if (!buffer.empty())
+        {
+            rx_buffer_ = std::move(buffer);
+            rx_start_ = 0;
+            rx_end_ = 0;
+        }
+
+        rx_end_ += size;
+
+        while (rx_end_ - rx_start_ >= header_size)
+        {
+            uint8_t const *p = rx_buffer_.data() + rx_start_;
+
+            // 取长度字段
+            uint32_t length = 0;
+            uint8_t const *field = p + config.length_offset;
+            for (int i = 0; i < config.length_size; ++ i)
+            {
+                int index = config.big_endian ? i : (config.length_size - 1 - i);
+                length = (length << 8) | field[index];
+            }
+
+            int64_t total = static_cast<int64_t>(length) + config.length_adjust;
+
+            if ((total < static_cast<int64_t>(header_size)) || (total > static_cast<int64_t>(max_size)))
+            {
+                slog::error("tcp client({}) invalid message length: {}", brief(), total);
+                return false;
+            }
+
+            if (rx_end_ - rx_start_ < static_cast<std::size_t>(total))
+            {
+                // 等待更多数据
+                break;
+            }
+
+            if (event_handle_)
+            {
+                event_handle_(*this, Event::ReadAvailable, rx_buffer_, static_cast<int>(total), static_cast<int>(rx_start_));
+            }
+
+            rx_start_ += total;
+        }
+
+        std::size_t pending = rx_end_ - rx_start_;
+
+        if (pending == 0)
+        {
+            // 没有未完成的消息，归还缓存，空闲的连接不占用缓存
+            rx_buffer_.reset();
+            rx_start_ = 0;
+            rx_end_ = 0;
+        }
+        else if (pool_->block_size() - rx_start_ < max_size)
+        {
+            // 剩余空间可能放不下一个完整的消息，将未完成的部分移到缓存头部
+            if (rx_buffer_.use_count() == 1)
+            {
+                // 只有连接自己引用时原地移动
+                ::memmove(rx_buffer_.data(), rx_buffer_.data() + rx_start_, pending);
+            }
+            else 
+            {
+                // 缓存中的消息还被引用，复制到新的缓存中
+                uint8_t *data = pool_->allocate();
+                if (data == nullptr)
+                {
+                    slog::error("tcp client({}) allocate read buffer failed", brief());
+                    return false;
+                }
+
+                ::memcpy(data, rx_buffer_.data() + rx_start_, pending);
+                rx_buffer_ = SharedBuffer::adopt(data);
+            }
+
+            rx_start_ = 0;
+            rx_end_ = pending;
+        }
+
+        return true;
+    }
+
     /**
      * @brief 更新地址信息
      * 
@@ -325,7 +701,7 @@ private:
     {
         struct sockaddr_storage addr;
         int len = sizeof(addr);
-        uv_tcp_getpeername(&client_, reinterpret_cast<struct sockaddr*>(&addr), &len);
+        uv_tcp_getpeername(client_, reinterpret_cast<struct sockaddr*>(&addr), &len);
 
         char ip[INET6_ADDRSTRLEN];
         if (addr.ss_family == AF_INET) 
@@ -333,21 +709,23 @@ private:
             struct sockaddr_in* s = reinterpret_cast<struct sockaddr_in*>(&addr);
             uv_inet_ntop(AF_INET, &s->sin_addr, ip, sizeof(ip));
 
-            address_ = ip;
-            port_ = ntohs(s->sin_port);
+            host_.address = ip;
+            host_.port = ntohs(s->sin_port);
         } 
         else if (addr.ss_family == AF_INET6) 
         {
             struct sockaddr_in6* s = reinterpret_cast<struct sockaddr_in6*>(&addr);
             uv_inet_ntop(AF_INET6, &s->sin6_addr, ip, sizeof(ip));
 
-            address_ = ip;
-            port_ = ntohs(s->sin6_port);
+            host_.address = ip;
+            host_.port = ntohs(s->sin6_port);
         } 
         else 
         {
             slog::error("Unknown address family: {}", addr.ss_family);
         } 
+
+        brief_ = host_.address + ":" + std::to_string(host_.port);
     }
 };
 
@@ -355,65 +733,1008 @@ private:
 
 
 /**
- * @brief 创建一个TCP服务端
+ * @brief 发送队列中的一帧，数据是共享的，广播时所有连接共用一份
  * 
- * @param name 名称
- * @param address 地址
- * @param port 端口
- * @param max_clients_num  最大连接数，0 不限制 
  */
-TcpServer::TcpServer(std::string const &name, 
-    std::string const &address, 
-    int port, 
-    std::size_t max_clients_num) : 
-    uv::TcpServer(uv::Loop::Type::New),     
-    address_(address), 
-    port_(port),
-    name_(name),     
-    max_clients_num_(max_clients_num),
-    receive_callback_(nullptr)
+struct TxFrame
 {
-    /// 设置对象数据？
-    //uv_handle_set_data((uv_handle_t*)&server_, this);
-    server_.data = this;
-
-    // 设置brief
-    brief_ = address_ + ":" + std::to_string(port_);
+    Host host;
+    SharedPayload payload;
+    /// 分段发送时的所有分段，此时payload为空
+    std::vector<SharedPayload> segments;
 
-    slog::debug("create tcp server({}) with {}", name_, brief_);
-}
+    /// 返回第一个分段
+    SharedPayload const * begin() const
+    {
+        return segments.empty() ? &payload : segments.data();
+    }
 
+    /// 返回分段数量
+    int count() const
+    {
+        return segments.empty() ? (payload.empty() ? 0 : 1) : static_cast<int>(segments.size());
+    }
 
-/**
- * @brief 析构TCP服务
- * 
- */
-TcpServer::~TcpServer()
-{    
-    // 先关闭所有的连接
-    stop();
-}
+    /// 返回总字节数
+    std::size_t size() const
+    {
+        std::size_t size = payload.size();
+        for (auto const &segment : segments)
+        {
+            size += segment.size();
+        }
 
-/**
- * @brief 获取TCP服务的名称
- * 
- * @return const std::string& 
- */
-std::string const & TcpServer::name()
-{
-    return name_;
-}
+        return size;
+    }
+};
 
 
 /**
- * @brief 获取一个简称
+ * @brief 一个loop线程，及分配给它的连接
  * 
- * @return const std::string& 
+ * @note 每个分片有自己的loop、监听句柄、发送队列和连接，连接只在所属分片的loop线程中访问。
+ *   连接id的低SHARD_BITS位为分片序号，发送时可以直接找到所属的分片
  */
-std::string const & TcpServer::brief()
+class TcpShard
 {
-    return brief_;
-}
+public:
+    /**
+     * @brief 创建一个分片
+     * 
+     * @param server 所属服务端
+     * @param index 分片序号
+     * @param loop 使用的loop，为nullptr时创建一个新的loop
+     */
+    TcpShard(TcpServer &server, int index, uv_loop_t *loop) : 
+        server_(server), 
+        index_(index),
+        loop_(loop)
+    {
+        if (loop_ == nullptr)
+        {
+            loop_ = new uv_loop_t;
+            uv_loop_init(loop_);
+            own_loop_ = true;
+        }
+    }
+
+    ~TcpShard()
+    {
+        stop();
+
+        if (own_loop_)
+        {
+            int ret = uv_loop_close(loop_);
+            if (ret != 0)
+            {
+                slog::warning("{}: close loop of shard-{} failed: {}", server_.name_, index_, uv_strerror(ret));
+            }
+
+            delete loop_;
+        }
+    }
+
+    // 禁止复制构造
+    TcpShard(const TcpShard &) = delete;
+    TcpShard & operator=(const TcpShard &) = delete;
+
+    /**
+     * @brief 监听端口，并启动loop线程，使用外部loop时不启动线程
+     * 
+     * @param reuseport 是否使用SO_REUSEPORT，多个分片监听同一端口时需要
+     * @return true 
+     * @return false 
+     */
+    bool start(bool reuseport)
+    {
+        int ret = bind(reuseport);
+        if (ret == 0)
+        {
+            listener_->data = this;
+            ret = uv_listen((uv_stream_t *)listener_, 128, [](uv_stream_t *server, int status) {
+                    auto self = static_cast<TcpShard *>(server->data);
+                    self->on_connection(status);
+                });
+        }
+
+        if (ret != 0)
+        {
+            slog::error("{}: shard-{} listen on {} failed: {}", server_.name_, index_, server_.brief_, uv_strerror(ret));
+
+            close_listener();
+
+            // loop线程还未运行，在当前线程中完成关闭
+            if (!server_.attached_)
+            {
+                uv_run(loop_, UV_RUN_NOWAIT);
+            }
+
+            return false;
+        }
+
+        tx_notify_.bind(loop_, [this]([[maybe_unused]]int id) {
+                drain();
+            });
+
+        // 丢弃上次停止时残留的帧
+        tx_frames_.clear();
+
+        running_ = true;
+
+        if (server_.attached_)
+        {
+            // 外部loop由使用者运行，start()需要在它的线程中调用
+            loop_thread_id_.store(std::this_thread::get_id());
+            return true;
+        }
+
+        stop_notify_.bind(loop_, [this]([[maybe_unused]]int id) {
+                uv_stop(loop_);
+            });
+
+        thread_ = std::thread(&TcpShard::run, this);
+
+        return true;
+    }
+
+    /**
+     * @brief 停止loop线程，关闭所有连接
+     * 
+     * @note 使用外部loop时，需要在loop的线程中调用，句柄在loop下次运行时完成关闭
+     */
+    void stop()
+    {
+        if (!running_)
+        {
+            return ;
+        }
+
+        // 先拒绝新的发送，再等待正在通知loop的调用者完成
+        running_ = false;
+        while (notifiers_.load() > 0)
+        {
+            std::this_thread::yield();
+        }
+
+        if (server_.attached_)
+        {
+            tx_notify_.close();
+            close_handles();
+        }
+        else 
+        {
+            stop_notify_.notify();
+            thread_.join();
+
+            // loop线程已退出后再关闭通知，避免和其他线程中的notify()竞争
+            tx_notify_.close();
+            stop_notify_.close();
+            uv_run(loop_, UV_RUN_NOWAIT);
+        }
+
+        // loop线程已退出，此时可以清空发送队列
+        tx_frames_.clear();
+        loop_thread_id_.store(std::thread::id());
+    }
+
+    /**
+     * @brief 发送一帧，在loop线程中直接写出，在其他线程中加入发送队列
+     * 
+     * @param frame 
+     * @return true 
+     * @return false 分片没有运行
+     */
+    bool send(TxFrame &&frame)
+    {
+        if (in_loop_thread())
+        {
+            write_direct(frame);
+            return true;
+        }
+
+        return push(std::move(frame));
+    }
+
+    /**
+     * @brief 加入一帧到发送队列，可以在任意线程中调用
+     * 
+     * @param frame 
+     * @return true 
+     * @return false 分片没有运行，不加入队列
+     */
+    bool push(TxFrame &&frame)
+    {
+        // stop()等待已经通过检查的调用者完成，之后才关闭通知
+        notifiers_.fetch_add(1);
+
+        bool running = running_.load();
+        if (running)
+        {
+            if (server_.write_policy_ == TcpServer::WritePolicy::Block)
+            {
+                server_.write_pending_bytes_.fetch_add(frame.size());
+            }
+
+            tx_frames_.push(std::move(frame));
+
+            // notify tx ready
+            tx_notify_.notify();
+        }
+
+        notifiers_.fetch_sub(1);
+
+        return running;
+    }
+
+    /**
+     * @brief 关闭所有连接，可以在任意线程中调用，在loop线程中执行
+     * 
+     */
+    void close_all_connections()
+    {
+        close_all_.store(true);
+        notify();
+    }
+
+    /**
+     * @brief 恢复暂停读取的连接，可以在任意线程中调用，在loop线程中执行
+     * 
+     */
+    void resume_reading()
+    {
+        resume_reading_.store(true);
+        notify();
+    }
+
+    /// 当前线程是否为这个分片的loop线程
+    bool in_loop_thread() const
+    {
+        return running_ && (std::this_thread::get_id() == loop_thread_id_.load());
+    }
+
+private:
+    TcpServer &server_;
+    int index_;
+
+    uv_loop_t *loop_;
+    bool own_loop_ = false;
+    /// 监听句柄，在关闭回调中释放
+    uv_tcp_t *listener_ = nullptr;
+
+    std::thread thread_;
+    /// 发送者在其他线程中检查
+    std::atomic<bool> running_ {false};
+    /// 正在其他线程中通知loop的调用者数量
+    std::atomic<int> notifiers_ {0};
+    /// 运行loop的线程，发送者在其他线程中比较，不能直接读取thread_
+    std::atomic<std::thread::id> loop_thread_id_;
+
+    uv::AsyncSignal tx_notify_;
+    uv::AsyncSignal stop_notify_;
+
+    /// 发送帧FIFO，任意线程写入，loop线程读出，不加锁
+    MpscQueue<TxFrame> tx_frames_;
+    /// 是否需要关闭所有连接
+    std::atomic<bool> close_all_ {false};
+    /// 是否需要恢复暂停读取的连接
+    std::atomic<bool> resume_reading_ {false};
+
+    /// TCP连接，以连接id为索引
+    std::unordered_map<uint32_t, std::unique_ptr<TcpConnection>> connections_;
+    /// 下一个连接序号
+    uint32_t next_seq_ = 1;
+
+    int bind(bool reuseport);
+    void notify();
+    void run();
+    void close_listener();
+    void close_handles();
+    void drain();
+    TcpConnection * dispatch(TxFrame const &frame);
+    void write_direct(TxFrame const &frame);
+    void on_connection(int status);
+    void handle_event(TcpConnection &connection, TcpConnection::Event event, SharedBuffer &buffer, int size, int offset);
+    TcpConnection * find_connection(Host const &host);
+    void write_frame(TcpConnection &connection, TxFrame const &frame, std::size_t size);
+    void write_complete(TcpConnection &connection);
+    void set_congested(TcpConnection &connection, bool congested);
+    void remove_connection(TcpConnection &connection);
+    void remove_closed_connections();
+    void close_connections();
+};
+
+/**
+ * @brief 初始化监听句柄，并绑定到服务端的地址
+ * 
+ * @param reuseport 
+ * @return int 
+ */
+int TcpShard::bind(bool reuseport)
+{
+    struct sockaddr_in addr;
+
+    listener_ = new uv_tcp_t;
+    uv_tcp_init(loop_, listener_);
+
+    int ret = uv_ip4_addr(server_.address_.c_str(), server_.port_, &addr);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    if (!reuseport)
+    {
+        return uv_tcp_bind(listener_, (const struct sockaddr *)&addr, 0);
+    }
+
+    // libuv 1.49之前不支持UV_TCP_REUSEPORT，自己创建socket
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    int on = 1;
+    if ((setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) 
+        || (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+        || (::bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0))
+    {
+        ret = -errno;
+        ::close(fd);
+        return ret;
+    }
+
+    ret = uv_tcp_open(listener_, fd);
+    if (ret != 0)
+    {
+        ::close(fd);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief 在任意线程中唤醒loop线程处理发送队列和标志，分片没有运行时忽略
+ * 
+ */
+void TcpShard::notify()
+{
+    notifiers_.fetch_add(1);
+
+    if (running_.load())
+    {
+        tx_notify_.notify();
+    }
+
+    notifiers_.fetch_sub(1);
+}
+
+/**
+ * @brief LOOP 线程
+ * 
+ */
+void TcpShard::run()
+{
+    slog::trace("{}: loop thread-{} started", server_.name_, index_);
+
+    loop_thread_id_.store(std::this_thread::get_id());
+
+    uv_run(loop_, UV_RUN_DEFAULT);   
+
+    // 关闭后再运行一次loop，执行关闭回调
+    close_handles();
+    uv_run(loop_, UV_RUN_NOWAIT);
+
+    slog::trace("{}: loop thread-{} exited", server_.name_, index_);    
+}
+
+/**
+ * @brief 关闭监听句柄
+ * 
+ * @note 句柄在关闭回调中释放，回调不访问分片，使用外部loop时分片可以在回调执行前析构
+ */
+void TcpShard::close_listener()
+{
+    if (listener_ == nullptr)
+    {
+        return ;
+    }
+
+    listener_->data = nullptr;
+    uv_close((uv_handle_t *)listener_, [](uv_handle_t *handle) {
+            delete reinterpret_cast<uv_tcp_t *>(handle);
+        });
+    listener_ = nullptr;
+}
+
+/**
+ * @brief 关闭所有连接和监听句柄，在loop线程中调用
+ * 
+ */
+void TcpShard::close_handles()
+{
+    close_connections();
+    close_listener();
+}
+
+/**
+ * @brief 处理发送通知
+ * 
+ */
+void TcpShard::drain()
+{
+    slog::trace("{}: get tx notify", server_.name_);
+
+    if (close_all_.exchange(false))
+    {
+        close_connections();
+    }
+
+    if (resume_reading_.exchange(false))
+    {
+        for (auto &it : connections_)
+        {
+            TcpConnection &conn = *it.second;
+            if (conn.is_connected() && conn.is_read_paused())
+            {
+                slog::debug("{}: connection({}) resume reading", server_.name_, conn.brief());
+                conn.read_start();
+            }
+        }
+    }
+
+    // 取出所有待发送的帧，按连接归类，保持每个连接的发送顺序
+    // 生产者加入的帧暂时不可见时，它随后的通知会再次唤醒这里
+    TxFrame frame;
+    int frames = 0;
+
+    while ((frames < TX_DRAIN_MAX) && tx_frames_.pop(frame))
+    {
+        frames ++;
+
+        if (server_.write_policy_ == TcpServer::WritePolicy::Block)
+        {
+            server_.write_pending_bytes_.fetch_sub(frame.size());
+        }
+
+        dispatch(frame);
+    }
+
+    slog::trace("{}: pop {} tx frames", server_.name_, frames);
+
+    // 释放最后一帧的引用
+    frame = TxFrame();
+
+    // 还有未处理的帧，下一轮loop继续，避免生产者持续写入时loop无法处理其他事件
+    if (frames >= TX_DRAIN_MAX)
+    {
+        tx_notify_.notify();
+    }
+
+    // 每个连接只调用一次uv_write
+    for (auto &it : connections_)
+    {
+        it.second->flush();
+    }
+
+    // 删除因拥塞被断开的连接
+    remove_closed_connections();
+
+    // 队列中的帧已处理，唤醒等待的发送者
+    if (server_.write_policy_ == TcpServer::WritePolicy::Block)
+    {
+        server_.write_wakeup();
+    }
+}
+
+/**
+ * @brief 将一帧加入目标连接的发送列表
+ * 
+ * @param frame 
+ * @return TcpConnection* 单播时返回目标连接，广播或者没有找到时返回nullptr
+ */
+TcpConnection * TcpShard::dispatch(TxFrame const &frame)
+{
+    std::size_t size = frame.size();
+    if (size == 0)
+    {
+        return nullptr;
+    }
+
+    Host const & host = frame.host;
+    // 如果id和port都为0，表示发给所有的客户端，所有连接共享同一份数据
+    if ((host.id == 0) && (host.port == 0))
+    {
+        for (auto &it : connections_)
+        {
+            write_frame(*it.second, frame, size);
+        }
+    }
+    else 
+    {
+        TcpConnection *conn = find_connection(host);
+        if (conn)
+        {
+            write_frame(*conn, frame, size);
+            return conn;
+        }
+        
+        if ((host.id != 0) || (server_.shards_.size() == 1))
+        {
+            // 只有地址的主机会交给所有分片，只有一个分片能找到
+            slog::warning("{}: send failed, not such host({}:{}, id:{})", server_.name_, host.address, host.port, host.id);
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief 在loop线程中直接写出一帧，不经过发送队列
+ * 
+ * @param frame 
+ * 
+ * @note 可能在连接的读回调中调用，这里不删除连接，因拥塞断开的连接在下次处理发送通知时删除
+ */
+void TcpShard::write_direct(TxFrame const &frame)
+{
+    bool closed = false;
+
+    TcpConnection *conn = dispatch(frame);
+    if (conn)
+    {
+        conn->flush();
+        closed = !conn->is_connected();
+    }
+    else if ((frame.host.id == 0) && (frame.host.port == 0))
+    {
+        for (auto &it : connections_)
+        {
+            it.second->flush();
+            closed = closed || !it.second->is_connected();
+        }
+    }
+
+    if (closed)
+    {
+        tx_notify_.notify();
+    }
+}
+
+/**
+ * @brief 处理新连接
+ * 
+ * @param status 
+ */
+void TcpShard::on_connection(int status)
+{
+    if (status < 0)
+    {
+        slog::error("{}: listen callback return unexpected error: {}", server_.name_, uv_strerror(status));
+        return ;
+    }
+
+    // 是否超过最多连接数了
+    if ((server_.max_clients_num_ > 0) && (static_cast<std::size_t>(server_.connections_num_.load()) >= server_.max_clients_num_))
+    {
+        slog::warning("{}: connection reach max limited, ignore connection request", server_.name_);
+        return;
+    }
+
+    // 分配一个连接id，低位为分片序号，序号跳过0
+    uint32_t seq = next_seq_ ++;
+    if ((seq << SHARD_BITS) == 0)
+    {
+        seq = next_seq_ ++;
+    }
+
+    uint32_t id = (seq << SHARD_BITS) | static_cast<uint32_t>(index_);
+
+    auto conn = std::make_unique<TcpConnection>(loop_, id, *server_.rx_pool_, 
+        (server_.framer_.length_size > 0) ? &server_.framer_ : nullptr,
+        // 连接事件处理函数
+        [this](TcpConnection &connection, TcpConnection::Event event, SharedBuffer &buffer, int size, int offset) {
+            handle_event(connection, event, buffer, size, offset);
+        });
+
+    if (conn->accept(server_.name_, *listener_))
+    {
+        // 添加到连接列表
+        std::string const & client = conn->brief();
+
+        // 更新客户端信息
+        {
+            std::lock_guard<std::mutex> lock(server_.clients_mutex_);
+            conn->attach_client_info(server_.get_client_info(conn->get_address(), conn->get_port()));
+        }
+        
+        // 加入容器
+        connections_.emplace(id, std::move(conn));
+        int total = server_.connections_num_.fetch_add(1) + 1;
+
+        // give a log
+        slog::info("{}: connection({}) setup success, total: {}", server_.name_, client, total);
+    }
+}
+
+/**
+ * @brief 连接事件处理函数
+ * 
+ * @param connection 
+ * @param event 
+ * @param buffer 
+ * @param size 
+ * @param offset 数据在缓存中的偏移
+ */
+void TcpShard::handle_event(TcpConnection &connection, TcpConnection::Event event, SharedBuffer &buffer, int size, int offset)
+{
+    if (event != TcpConnection::Event::WriteComplete)
+    {
+        slog::debug("{}: client({}) event: {}", server_.name_, connection.brief(), static_cast<int>(event));
+    }
+
+    if (event == TcpConnection::Event::ConnectionLost)
+    {
+        slog::warning("{}: connection({}) lost, removed", server_.name_, connection.brief());
+        remove_connection(connection);
+    }
+    else if (event == TcpConnection::Event::WriteComplete)
+    {
+        write_complete(connection);
+    }
+    else if (event == TcpConnection::Event::ReadAvailable) 
+    {
+        if (server_.receive_callback_)
+        {
+            // call back 
+            server_.receive_callback_(connection.get_host(), buffer.data() + offset, size);
+        }
+        else 
+        {
+            // 数据较多时帧直接引用缓存，数据较少时复制，避免小帧长期占用整块缓存
+            DataFrame frame = (static_cast<std::size_t>(size) >= server_.rx_pool_->block_size() / RX_ADOPT_DIVISOR) ? 
+                DataFrame(connection.get_host(), buffer, size, offset) : 
+                DataFrame(connection.get_host(), buffer.data() + offset, size);
+            slog::trace("{}: queue rx frame-{}(size:{}, from:{})", server_.name_, frame.id(), size, connection.brief());
+
+            // 入队列 
+            std::lock_guard<std::mutex> lock(server_.rx_mutex_);
+
+            if (server_.read_queue_exceeded(frame.size()))
+            {
+                if (server_.read_policy_ == TcpServer::ReadPolicy::DropNewest)
+                {
+                    server_.read_dropped_newest_ ++;
+                    return ;
+                }
+                
+                if (server_.read_policy_ == TcpServer::ReadPolicy::DropOldest)
+                {
+                    while (!server_.rx_frames_.empty() && server_.read_queue_exceeded(frame.size()))
+                    {
+                        server_.read_queue_pop();
+                        server_.read_dropped_oldest_ ++;
+                    }
+                }
+                else if (!connection.is_read_paused())
+                {
+                    // 已读到的帧仍然入队列，之后的数据留在内核中
+                    slog::debug("{}: rx queue full, connection({}) pause reading", server_.name_, connection.brief());
+                    connection.read_pause();
+                    server_.rx_paused_ = true;
+                    server_.read_paused_ ++;
+                }
+            }
+
+            server_.rx_bytes_ += frame.size();
+            server_.rx_frames_.emplace(std::move(frame));
+
+            // 通知外部线程读取数据
+            server_.rx_notify_.notify();
+            server_.rx_cond_.notify_one();
+        }
+    }
+}
+
+/**
+ * @brief 查找一个连接
+ * 
+ * @param host 
+ * @return TcpConnection* 没有找到时返回nullptr
+ */
+TcpConnection * TcpShard::find_connection(Host const &host)
+{
+    if (host.id != 0)
+    {
+        auto it = connections_.find(host.id);
+        return (it != connections_.end()) ? it->second.get() : nullptr;
+    }
+
+    // 兼容只有地址和端口的主机
+    for (auto &it : connections_)
+    {
+        if ((it.second->get_port() == host.port) && (it.second->get_address() == host.address))
+        {
+            return it.second.get();
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief 按发送水位和拥塞策略，将一帧加入连接的发送列表
+ * 
+ * @param connection 
+ * @param frame 所有分段一起加入或者丢弃
+ * @param size 帧的总字节数
+ */
+void TcpShard::write_frame(TcpConnection &connection, TxFrame const &frame, std::size_t size)
+{
+    if (!connection.is_connected())
+    {
+        return ;
+    }
+
+    if (!connection.is_congested())
+    {
+        // 待发送列表较多时先写出，由内核缓存，再检查是否拥塞
+        if (connection.write_queue_size() + size > server_.write_high_)
+        {
+            connection.flush();
+        }
+
+        if (connection.write_queue_size() + size <= server_.write_high_)
+        {
+            connection.queue(frame.begin(), frame.count());
+            return ;
+        }
+
+        // libuv的写队列为空时，不会再有写完成来解除拥塞，超过高水位的单帧也直接写出
+        if (connection.write_queue_size() == 0)
+        {
+            connection.queue(frame.begin(), frame.count());
+            connection.flush();
+            return ;
+        }
+
+        server_.write_congested_.fetch_add(1, std::memory_order_relaxed);
+        slog::warning("{}: connection({}) write queue reach {} bytes, congested", server_.name_, connection.brief(), connection.write_queue_size());
+
+        if (server_.write_policy_ == TcpServer::WritePolicy::Disconnect)
+        {
+            server_.write_disconnected_.fetch_add(1, std::memory_order_relaxed);
+            slog::warning("{}: connection({}) is too slow, disconnect it", server_.name_, connection.brief());
+
+            // 连接在本轮发送完成后删除
+            connection.close();
+            return ;
+        }
+
+        set_congested(connection, true);
+    }
+
+    switch (server_.write_policy_)
+    {
+        case TcpServer::WritePolicy::Block:
+            // 发送者已被阻塞，已进入队列的帧仍然发送
+            connection.queue(frame.begin(), frame.count());
+            break;
+
+        case TcpServer::WritePolicy::DropOldest:
+            server_.write_dropped_oldest_.fetch_add(connection.backlog(frame.begin(), frame.count(), server_.write_high_ - server_.write_low_), std::memory_order_relaxed);
+            break;
+
+        default:
+            server_.write_dropped_newest_.fetch_add(1, std::memory_order_relaxed);
+            break;
+    }
+}
+
+/**
+ * @brief 连接的写请求完成，检查是否可以解除拥塞
+ * 
+ * @param connection 
+ */
+void TcpShard::write_complete(TcpConnection &connection)
+{
+    if (!connection.is_congested() || (connection.write_queue_size() > server_.write_low_))
+    {
+        return ;
+    }
+
+    slog::info("{}: connection({}) write queue drained", server_.name_, connection.brief());
+
+    set_congested(connection, false);
+
+    // 发出拥塞期间缓存的帧
+    connection.release_backlog();
+    connection.flush();
+}
+
+/**
+ * @brief 设置连接的拥塞状态，并唤醒等待的发送者
+ * 
+ * @param connection 
+ * @param congested 
+ */
+void TcpShard::set_congested(TcpConnection &connection, bool congested)
+{
+    if (connection.is_congested() == congested)
+    {
+        return ;
+    }
+
+    connection.set_congested(congested);
+
+    if (server_.write_policy_ != TcpServer::WritePolicy::Block)
+    {
+        return ;
+    }
+
+    // 只在loop线程中修改
+    server_.write_congested_num_.fetch_add(congested ? 1 : -1);
+
+    if (!congested)
+    {
+        server_.write_wakeup();
+    }
+}
+
+/**
+ * @brief 删除一个连接
+ * 
+ * @param connection 
+ */
+void TcpShard::remove_connection(TcpConnection &connection)
+{
+    // 按id查找，id不会重复
+    auto it = connections_.find(connection.id());
+    if (it == connections_.end())
+    {
+        return ;
+    }
+
+    slog::trace("find connection({}), remove it", connection.brief());
+
+    // 更新客户端信息
+    server_.sync_client_info(connection);
+
+    // 唤醒等待这个连接的发送者
+    set_congested(connection, false);
+
+    connections_.erase(it);
+    server_.connections_num_.fetch_sub(1);
+}
+
+/**
+ * @brief 删除已断开的连接
+ * 
+ */
+void TcpShard::remove_closed_connections()
+{
+    for (auto it = connections_.begin(); it != connections_.end(); )
+    {
+        TcpConnection &conn = *it->second;
+
+        if (conn.is_connected())
+        {
+            ++ it;
+            continue;
+        }
+
+        server_.sync_client_info(conn);
+        set_congested(conn, false);
+        it = connections_.erase(it);
+        server_.connections_num_.fetch_sub(1);
+    }
+}
+
+/**
+ * @brief 关闭并删除所有连接
+ * 
+ */
+void TcpShard::close_connections()
+{
+    for (auto &it : connections_)
+    {
+        it.second->close();
+    }
+
+    remove_closed_connections();
+}
+
+
+
+/**
+ * @brief 创建一个TCP服务端
+ * 
+ * @param name 名称
+ * @param address 地址
+ * @param port 端口
+ * @param max_clients_num  最大连接数，0 不限制 
+ */
+TcpServer::TcpServer(std::string const &name, 
+    std::string const &address, 
+    int port, 
+    std::size_t max_clients_num) : 
+    uv::TcpServer(uv::Loop::Type::New),     
+    address_(address), 
+    port_(port),
+    name_(name),     
+    max_clients_num_(max_clients_num),
+    rx_pool_(BufferPool::create()),
+    receive_callback_(nullptr)
+{
+    // 设置brief
+    brief_ = address_ + ":" + std::to_string(port_);
+
+    slog::debug("create tcp server({}) with {}", name_, brief_);
+}
+
+/**
+ * @brief 创建一个使用外部loop的TCP服务端
+ * 
+ * @param loop 外部loop，由使用者运行
+ * @param name 名称
+ * @param address 地址
+ * @param port 端口
+ * @param max_clients_num  最大连接数，0 不限制 
+ */
+TcpServer::TcpServer(uv::Loop &loop,
+    std::string const &name, 
+    std::string const &address, 
+    int port, 
+    std::size_t max_clients_num) : 
+    uv::TcpServer(loop.get()),     
+    address_(address), 
+    port_(port),
+    name_(name),     
+    max_clients_num_(max_clients_num),
+    attached_(true),
+    rx_pool_(BufferPool::create()),
+    receive_callback_(nullptr)
+{
+    // 设置brief
+    brief_ = address_ + ":" + std::to_string(port_);
+
+    slog::debug("create tcp server({}) with {} on external loop", name_, brief_);
+}
+
+
+/**
+ * @brief 析构TCP服务
+ * 
+ */
+TcpServer::~TcpServer()
+{    
+    // 先关闭所有的连接
+    stop();
+
+    // 分片0使用基类的loop，需要在基类析构之前删除
+    shards_.clear();
+}
+
+/**
+ * @brief 获取TCP服务的名称
+ * 
+ * @return const std::string& 
+ */
+std::string const & TcpServer::name()
+{
+    return name_;
+}
+
+
+/**
+ * @brief 获取一个简称
+ * 
+ * @return const std::string& 
+ */
+std::string const & TcpServer::brief()
+{
+    return brief_;
+}
 
 
 /**
@@ -430,51 +1751,54 @@ bool TcpServer::start(ReceiveCallback callback)
         return false;
     }
 
-    int ret = bind(address_, port_);
-    if (ret != 0)
+    // 分帧时整条消息需要放在一块接收缓存中
+    if ((framer_.length_size > 0) && (static_cast<std::size_t>(framer_.max_size) > rx_pool_->block_size()))
     {
-        slog::error("{}: bind to {} failed: {}", name_, brief_, uv_strerror(ret));
+        slog::error("{}: framer max size {} exceeds read buffer size {}", name_, framer_.max_size, rx_pool_->block_size());
         return false;
     }
 
-    int backlog = 128;
-
-    ret = listen(backlog, [](uv_stream_t *server, int status)
+    // 分片数量变化时重新创建，分片0使用基类的loop和监听句柄
+    if (shards_.size() != static_cast<std::size_t>(loop_threads_))
+    {
+        shards_.clear();
+        for (int i = 0; i < loop_threads_; ++ i)
         {
-            auto self = static_cast<TcpServer*>(server->data);
+            shards_.emplace_back(new TcpShard(*this, i, (i == 0) ? loop_ : nullptr));
+        }
+    }
 
-            if (status < 0)
+    // set rx callback，需要在loop线程启动前设置
+    receive_callback_ = callback;
+
+    // 停止期间的发送已被拒绝，这里清除可能残留的计数
+    write_congested_num_.store(0);
+    write_pending_bytes_.store(0);
+
+    for (std::size_t i = 0; i < shards_.size(); ++ i)
+    {
+        if (!shards_[i]->start(shards_.size() > 1))
+        {
+            for (std::size_t k = 0; k < i; ++ k)
             {
-                slog::error("{}: listen callback return unexpected error: {}", self->name(), uv_strerror(status));
-                return ;
+                shards_[k]->stop();
             }
 
-            // 是否超过最多连接数了
-            if ((self->max_clients_num_ > 0) && (self->connections_.size() >= self->max_clients_num_)){
-                slog::warning("{}: connection reach max limited, ignore connection request", self->name());
-                return;
-            }
-            
-            // 建立一个新连接
-            self->setup_connection();      
-        });
+            return false;
+        }
+    }
+
+    started_ = true;
 
-    if (ret != 0)
     {
-        slog::error("{}: listen failed: {}", name_, uv_strerror(ret));
-        return false;
+        std::lock_guard<std::mutex> lock(rx_mutex_);
+        rx_stopped_ = false;
     }
 
-    slog::info("{}: listen on {} success", name_, brief_);
-
-    // set rx callback 
-    receive_callback_ = callback;
+    slog::info("{}: listen on {} success, {} loop threads", name_, brief_, shards_.size());
 
     slog::info("{}: callback {}, receive queue will be {}", name_, receive_callback_ ? "enabled" : "disabled", receive_callback_ ? "disabled" : "enabled");
 
-    // 创建一个线程，运行uv loop
-    thread_ = std::thread(&TcpServer::loop_thread, this);
-
     return true;
 }
 
@@ -489,33 +1813,31 @@ void TcpServer::stop()
 
     if (started_)
     {
-        // 关闭关送通知
-        tx_notify_.close();
-
-        close_all_connections();
+        // 连接和句柄在loop线程退出前关闭，不能在其他线程中操作
+        slog::trace("-> wait for thread exit");
 
-        // 清空接收和发送FIFO
+        for (auto &shard : shards_)
         {
-            std::lock_guard<std::mutex> lock(rx_mutex_);
-            decltype(rx_frames_)().swap(rx_frames_);
+            shard->stop();
         }
 
+        // 清空接收FIFO，唤醒等待接收的线程
         {
-            std::lock_guard<std::mutex> lock(tx_mutex_);
-            decltype(tx_frames_)().swap(tx_frames_);
+            std::lock_guard<std::mutex> lock(rx_mutex_);
+            decltype(rx_frames_)().swap(rx_frames_);
+            rx_bytes_ = 0;
+            rx_paused_ = false;
+            rx_stopped_ = true;
         }
 
-        uv_tcp_close_reset(&server_, nullptr);
-
-        thread_exit_ = true;
-        
-        //uv_stop(loop_);
-        async_stop();
+        rx_cond_.notify_all();
 
-        // 停止线程
-        slog::trace("-> wait for thread exit");
+        // 唤醒被阻塞的发送者
+        write_congested_num_.store(0);
+        write_pending_bytes_.store(0);
+        write_wakeup();
 
-        thread_.join();
+        started_ = false;
     }
 }
 
@@ -551,180 +1873,266 @@ bool TcpServer::is_running()
 }
 
 /**
- * @brief LOOP 线程
+ * @brief 设置loop线程数量
  * 
+ * @param threads 
+ * @return true 
+ * @return false 
  */
-void TcpServer::loop_thread()
+bool TcpServer::set_loop_threads(int threads)
 {
-    started_ = true;
+    if (started_)
+    {
+        slog::warning("{}: set loop threads failed, server is running", name_);
+        return false;
+    }
+
+    if (attached_ && (threads != 1))
+    {
+        slog::warning("{}: set loop threads failed, server uses an external loop", name_);
+        return false;
+    }
+
+    if ((threads < 1) || (threads > SHARD_MAX))
+    {
+        slog::warning("{}: invalid loop threads: {}, should be 1~{}", name_, threads, SHARD_MAX);
+        return false;
+    }
+
+    loop_threads_ = threads;
+
+    return true;
+}
+
+/**
+ * @brief 设置按长度字段分帧
+ * 
+ * @param config 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::set_framer(TcpFramerConfig const &config)
+{
+    if (started_)
+    {
+        slog::warning("{}: set framer failed, server is running", name_);
+        return false;
+    }
+
+    if (config.length_size == 0)
+    {
+        framer_.length_size = 0;
+        return true;
+    }
 
-    thread_exit_ = false;
+    if (((config.length_size != 1) && (config.length_size != 2) && (config.length_size != 4)) 
+        || (config.length_offset < 0) 
+        || (config.max_size < config.length_offset + config.length_size))
+    {
+        slog::warning("{}: invalid framer config: offset={}, size={}, max={}", name_, config.length_offset, config.length_size, config.max_size);
+        return false;
+    }
 
-    slog::trace("{}: loop thread started", name_);
+    framer_ = config;
 
-    tx_notify_.bind(loop_, [this]([[maybe_unused]]int id){
+    slog::debug("{}: framer: offset={}, size={}, {}, adjust={}, max={}", name_, framer_.length_offset, framer_.length_size, 
+        framer_.big_endian ? "big-endian" : "little-endian", framer_.length_adjust, framer_.max_size);
 
-        slog::trace("{}: get tx notify", name_);
-        // 检查发送队列，是否有数据需要发送
-        int pendings = 0;
+    return true;
+}
 
+/**
+ * @brief 当前线程是否为某个分片的loop线程
+ * 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::in_loop_thread()
+{
+    for (auto &shard : shards_)
+    {
+        if (shard->in_loop_thread())
         {
-            std::lock_guard<std::mutex> lock(tx_mutex_);
-            pendings = tx_frames_.size();
+            return true;
         }
+    }
 
-        while (pendings > 0)
-        {
-            DataFrame frame(0);
+    return false;
+}
 
-            {
-                std::lock_guard<std::mutex> lock(tx_mutex_);                
-                frame = std::move(tx_frames_.front());
-                tx_frames_.pop();                    
-                pendings = tx_frames_.size();
-            }
 
-            slog::trace("{}: pop tx frame-{}, pending:{}", name_, frame.id(), pendings);
-                        
-            if (!frame.is_empty())
-            {
-                Host const & host = frame.get_host();
-                // 如果port 为0，表示发给所有的客户端
-                if (host.port == 0)
-                {
-                    for (auto &it : connections_)
-                    {
-                        slog::trace("{}: send frame-{} to host:{}", name_, frame.id(), (*it).brief());
-                        (*it).send(frame);
-                    }
-                }
-                else 
-                {
-                    // 从连接中找到这个客户端
-                    auto it = std::find_if(connections_.begin(), connections_.end(), [&](const std::unique_ptr<TcpConnection>& conn) {
-                        return (((*conn).get_address() == host.address) && ((*conn).get_port() == host.port)); 
-                    });
+/**
+ * @brief 获取当前连接数
+ * 
+ * @return int 
+ */
+int TcpServer::connections_num()
+{
+    return connections_num_.load();
+}
 
-                    if (it != connections_.end())
-                    {
-                        slog::trace("{}: send frame-{} to host:{}", name_, frame.id(), it->get()->brief());
-                        it->get()->send(frame);                    
-                    }
-                    else 
-                    {
-                        slog::warning("{}: send failed, not such host({}:{})", name_, host.address, host.port);
-                    }
-                }            
-            }            
-        }
-    });
 
-    uv_run(loop_, UV_RUN_DEFAULT);   
+/**
+ * @brief 清空所有连接
+ * 
+ * @note 在各个loop线程中异步执行
+ */
+void TcpServer::close_all_connections()
+{
+    for (auto &shard : shards_)
+    {
+        shard->close_all_connections();
+    }
+}
+
+/**
+ * @brief 设置接收缓存池
+ * 
+ * @param block_size 
+ * @param block_num 
+ * @param huge_pages 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::set_read_buffers(std::size_t block_size, std::size_t block_num, bool huge_pages)
+{
+    if (started_)
+    {
+        slog::warning("{}: set read buffers failed, server is running", name_);
+        return false;
+    }
+
+    if (block_size == 0)
+    {
+        return false;
+    }
 
-    slog::trace("{}: loop thread exited", name_);    
+    rx_pool_ = BufferPool::create(block_size, block_num, huge_pages);
 
-    started_ = false;
+    return true;
 }
 
-
 /**
- * @brief 获取当前连接数
+ * @brief 返回接收缓存池的统计信息
  * 
- * @return int 
+ * @return BufferPoolStatistics 
  */
-int TcpServer::connections_num()
+BufferPoolStatistics TcpServer::get_read_buffer_statistics()
 {
-    return connections_.size();
+    return rx_pool_->get_statistics();
 }
 
-
 /**
- * @brief 清空所有连接
+ * @brief 设置每个连接的发送水位和拥塞策略
  * 
+ * @param high 
+ * @param low 
+ * @param policy 
+ * @return true 
+ * @return false 
  */
-void TcpServer::close_all_connections()
+bool TcpServer::set_write_watermarks(std::size_t high, std::size_t low, WritePolicy policy)
 {
-    /// 删除所有连接
-    if (connections_.size() > 0)
+    if (started_)
+    {
+        slog::warning("{}: set write watermarks failed, server is running", name_);
+        return false;
+    }
+
+    if ((high == 0) || (low >= high))
     {
-        decltype(connections_)().swap(connections_);
-    }    
+        slog::warning("{}: invalid write watermarks, high={}, low={}", name_, high, low);
+        return false;
+    }
+
+    write_high_ = high;
+    write_low_ = low;
+    write_policy_ = policy;
+
+    return true;
 }
 
 /**
- * @brief 处理新连接
+ * @brief 返回发送流控统计信息
  * 
+ * @return TcpWriteStatistics 
  */
-void TcpServer::setup_connection()
+TcpWriteStatistics TcpServer::get_write_statistics()
 {
-    auto conn = std::make_unique<TcpConnection>(get_loop(), 
-        // 连接事件处理函数
-        [this](TcpConnection &connection, TcpConnection::Event event, uint8_t const * const data, int size){
+    TcpWriteStatistics stats;
 
-            slog::debug("{}: client({}) event: {}", name_, connection.brief(), static_cast<int>(event));
-
-            if (event == TcpConnection::Event::ConnectionLost)
-            {
-                slog::warning("{}: connection({}) lost, removed", name_, connection.brief());
+    stats.congested = write_congested_.load(std::memory_order_relaxed);
+    stats.blocked = write_blocked_.load(std::memory_order_relaxed);
+    stats.dropped_newest = write_dropped_newest_.load(std::memory_order_relaxed);
+    stats.dropped_oldest = write_dropped_oldest_.load(std::memory_order_relaxed);
+    stats.disconnected = write_disconnected_.load(std::memory_order_relaxed);
 
-                auto it = std::find_if(connections_.begin(), connections_.end(), [&connection](const std::unique_ptr<TcpConnection>& conn) {
-                        // 使用brief()这个不可靠
-                        //return conn->brief() == connection.brief();
-                        // 使用指针指向它比较好
-                        return conn.get() == &connection;
-                    });
+    return stats;
+}
 
-                if (it != connections_.end())
-                {
-                    slog::trace("find connection({}), remove it", connection.brief());
+/**
+ * @brief 设置接收队列的上限和策略
+ * 
+ * @param max_frames 
+ * @param max_bytes 
+ * @param policy 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::set_read_queue_limits(std::size_t max_frames, std::size_t max_bytes, ReadPolicy policy)
+{
+    if (started_)
+    {
+        slog::warning("{}: set read queue limits failed, server is running", name_);
+        return false;
+    }
 
-                    // 更新客户端信息
-                    connection.update_client_info(get_client_info(connection.get_address(), connection.get_port()));
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    read_max_frames_ = max_frames;
+    read_max_bytes_ = max_bytes;
+    read_policy_ = policy;
 
-                    connections_.erase(it);
-                }
-            }
-            else if (event == TcpConnection::Event::ReadAvailable) 
-            {
+    return true;
+}
 
-                if (receive_callback_)
-                {
-                    auto host = connection.get_host();
-                    // call back 
-                    receive_callback_(host, data, size);
-                }
-                else 
-                {
-                    // 创建一个队列 
-                    DataFrame frame(connection.get_host(), data, size);
-                    slog::trace("{}: queue rx frame-{}(size:{}, from:{}) pending:{}", name_, frame.id(), size, connection.brief(), rx_frames_.size());
+/**
+ * @brief 返回接收队列统计信息
+ * 
+ * @return TcpReadStatistics 
+ */
+TcpReadStatistics TcpServer::get_read_statistics()
+{
+    TcpReadStatistics stats;
 
-                    // 入队列 
-                    std::lock_guard<std::mutex> lock(rx_mutex_);
-                    rx_frames_.emplace(std::move(frame));
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    stats.queued_frames = rx_frames_.size();
+    stats.queued_bytes = rx_bytes_;
+    stats.paused = read_paused_;
+    stats.dropped_newest = read_dropped_newest_;
+    stats.dropped_oldest = read_dropped_oldest_;
 
-                    // 通知外部线程读取数据
-                    rx_notify_.notify();
-                }
-            }
-        }
-    );
+    return stats;
+}
 
-    if (conn->accept(name_, server_))
+/**
+ * @brief 有发送者在等待时唤醒它们
+ * 
+ * @note 发送者先增加write_waiters_再检查条件，这里先修改条件再检查write_waiters_，
+ *   均为seq_cst，两者至少有一方能看到对方的修改，不会丢失唤醒
+ */
+void TcpServer::write_wakeup()
+{
+    if (write_waiters_.load() == 0)
     {
-        // 添加到连接列表
-        std::string const & client = conn->brief();
-
-        // 更新客户端信息
-        //ClientInfo info;
-        conn->update_client_info(get_client_info(conn->get_address(), conn->get_port()));
-        
-        // 加入容器
-        connections_.emplace_back(std::move(conn));
+        return ;
+    }
 
-        // give a log
-        slog::info("{}: connection({}) setup success, total: {}", name_, client, connections_.size());
+    {
+        // 保证等待者已进入wait()，或者还未检查条件
+        std::lock_guard<std::mutex> lock(write_wait_mutex_);
     }
+
+    write_wait_cond_.notify_all();
 }
 
 /**
@@ -736,6 +2144,7 @@ void TcpServer::setup_connection()
  */
 ClientInfo & TcpServer::get_client_info(std::string const & address, int port)
 {
+    // 调用者需要持有clients_mutex_
     // 查找这个客户端在不在，如果不在就创建一个新的。    
     auto it = std::find_if(clients_.begin(), clients_.end(), [&](const std::unique_ptr<ClientInfo>& client) {
             return (((*client).address == address) && ((*client).port == port)); 
@@ -757,12 +2166,25 @@ ClientInfo & TcpServer::get_client_info(std::string const & address, int port)
     return ret;
 }
 
+/**
+ * @brief 更新连接关联的客户端信息
+ * 
+ * @param connection 
+ */
+void TcpServer::sync_client_info(TcpConnection &connection)
+{
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    connection.sync_client_info();
+}
+
 /**
  * @brief 以info级别显示客户端状态信息
  * 
  */
 void TcpServer::dump_clients()
 {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+
     for (auto &it : clients_)
     {
         auto &client = *it;
@@ -793,21 +2215,148 @@ int TcpServer::received_frames_num()
  */
 DataFrame TcpServer::receive()
 {
-    std::lock_guard<std::mutex> lock(rx_mutex_);    
+    std::unique_lock<std::mutex> lock(rx_mutex_);    
     
     if (rx_frames_.empty())
     {
         return std::move(DataFrame(0));
     }
 
+    DataFrame frame = read_queue_pop();
+    bool resume = read_queue_drained();
+    lock.unlock();
+
+    if (resume)
+    {
+        read_resume();
+    }
+
+    return frame;
+}
+
+/**
+ * @brief 在一次加锁中从队列中取出多帧数据
+ * 
+ * @param frames 先清空，再加入取出的帧，可以重复使用以保留容量
+ * @param max_frames 最多取出的帧数量
+ * @return int 取出的帧数量
+ */
+int TcpServer::receive_batch(std::vector<DataFrame> &frames, int max_frames)
+{
+    frames.clear();
+
+    std::unique_lock<std::mutex> lock(rx_mutex_);
+
+    while (!rx_frames_.empty() && (static_cast<int>(frames.size()) < max_frames))
+    {
+        frames.emplace_back(read_queue_pop());
+    }
+
+    bool resume = read_queue_drained();
+    lock.unlock();
+
+    if (resume)
+    {
+        read_resume();
+    }
+
+    return static_cast<int>(frames.size());
+}
+
+/**
+ * @brief 等待并接收一帧数据
+ * 
+ * @param timeout 超时时间(ms)，小于0时一直等待
+ * @return DataFrame 超时或服务停止时DataFrame.is_empty() 为真
+ */
+DataFrame TcpServer::receive_wait(int timeout)
+{
+    std::unique_lock<std::mutex> lock(rx_mutex_);
+
+    auto ready = [this]() {
+            return !rx_frames_.empty() || rx_stopped_;
+        };
+
+    if (timeout < 0)
+    {
+        rx_cond_.wait(lock, ready);
+    }
+    else 
+    {
+        rx_cond_.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+    }
+
+    if (rx_frames_.empty())
+    {
+        return DataFrame(0);
+    }
+
+    DataFrame frame = read_queue_pop();
+    bool resume = read_queue_drained();
+    lock.unlock();
+
+    if (resume)
+    {
+        read_resume();
+    }
+
+    return frame;
+}
+
+/**
+ * @brief 从接收队列取出一帧
+ * 
+ * @return DataFrame 
+ */
+DataFrame TcpServer::read_queue_pop()
+{
     DataFrame frame = std::move(rx_frames_.front());
     rx_frames_.pop();
-    
+    rx_bytes_ -= frame.size();
+
     slog::trace("{}: pop rx frame-{}, pending:{}", name_, frame.id(), rx_frames_.size());
 
     return frame;
 }
 
+/**
+ * @brief 取出帧后检查是否可以恢复读取
+ * 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::read_queue_drained()
+{
+    if (!rx_paused_)
+    {
+        return false;
+    }
+
+    // 降到上限的一半以下时恢复，避免在上限附近反复暂停
+    if (((read_max_frames_ > 0) && (rx_frames_.size() > read_max_frames_ / 2)) 
+        || ((read_max_bytes_ > 0) && (rx_bytes_ > read_max_bytes_ / 2)))
+    {
+        return false;
+    }
+
+    rx_paused_ = false;
+    return true;
+}
+
+/**
+ * @brief 通知所有分片恢复暂停读取的连接
+ * 
+ */
+void TcpServer::read_resume()
+{
+    slog::debug("{}: rx queue drained, resume reading", name_);
+
+    for (auto &shard : shards_)
+    {
+        shard->resume_reading();
+    }
+}
+
 /**
  * @brief 发送数据到指定客户端
  * 
@@ -824,17 +2373,131 @@ bool TcpServer::send(Host const & host, void const * const data, int size)
         return false;
     }
 
-    DataFrame frame(host, (uint8_t const *)data, size);
+    // 只复制一次，广播时所有连接共用
+    TxFrame frame;
+    frame.host = host;
+    frame.payload = SharedPayload::copy(data, size);
+
+    return send_frame(std::move(frame));
+}
+
+/**
+ * @brief 分段发送，复制所有分段到一块连续的数据
+ * 
+ * @param host 
+ * @param segments 
+ * @param count 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::send(Host const & host, DataSegment const *segments, int count)
+{
+    if (segments == nullptr || count <= 0)
+    {
+        return false;
+    }
+
+    TxFrame frame;
+    frame.host = host;
+    frame.payload = SharedPayload::copy(segments, count);
 
-    slog::trace("{}: queue tx frame-{}(size:{}, to:{}:{}) pending:{}", name_, frame.id(), size, host.address, host.port, tx_frames_.size());
+    if (frame.payload.empty())
+    {
+        return false;
+    }
 
-    std::lock_guard<std::mutex> lock(tx_mutex_);
-    tx_frames_.emplace(std::move(frame));
+    return send_frame(std::move(frame));
+}
 
-    // notify tx ready
-    tx_notify_.notify();
+/**
+ * @brief 分段发送共享数据，每段作为一个uv_buf_t写出，不复制
+ * 
+ * @param host 
+ * @param segments 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::send(Host const & host, std::vector<SharedPayload> segments)
+{
+    // 去掉空的分段
+    segments.erase(std::remove_if(segments.begin(), segments.end(), [](SharedPayload const &segment) {
+            return segment.empty();
+        }), segments.end());
 
-    return true;
+    if (segments.empty())
+    {
+        return false;
+    }
+
+    TxFrame frame;
+    frame.host = host;
+    frame.segments = std::move(segments);
+
+    return send_frame(std::move(frame));
+}
+
+/**
+ * @brief 将一帧交给目标连接所在的分片
+ * 
+ * @param frame 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::send_frame(TxFrame &&frame)
+{
+    // 停止后分片仍然存在，不能再加入它们的发送队列
+    if (!started_ || shards_.empty())
+    {
+        slog::warning("{}: send failed, server is not started", name_);
+        return false;
+    }
+
+    if (write_policy_ == WritePolicy::Block)
+    {
+        // 有连接拥塞或者loop线程来不及处理时等待，loop线程中不能等待
+        if (write_blocked() && !in_loop_thread())
+        {
+            write_blocked_.fetch_add(1, std::memory_order_relaxed);
+
+            std::unique_lock<std::mutex> lock(write_wait_mutex_);
+            write_waiters_.fetch_add(1);
+            write_wait_cond_.wait(lock, [this]() {
+                    return !write_blocked();
+                });
+            write_waiters_.fetch_sub(1);
+        }
+    }
+
+    Host const & host = frame.host;
+
+    slog::trace("{}: queue tx frame(size:{}, segments:{}, to:{}:{}, id:{})", name_, frame.size(), frame.count(), host.address, host.port, host.id);
+
+    if (shards_.size() == 1)
+    {
+        return shards_[0]->send(std::move(frame));
+    }
+
+    if (host.id != 0)
+    {
+        // 连接id的低位为分片序号
+        std::size_t index = host.id & (SHARD_MAX - 1);
+        if (index >= shards_.size())
+        {
+            slog::warning("{}: send failed, invalid connection id:{}", name_, host.id);
+            return false;
+        }
+
+        return shards_[index]->send(std::move(frame));
+    }
+
+    // 广播或者只有地址的主机，交给所有分片，数据仍然共用
+    bool ret = true;
+    for (std::size_t i = 1; i < shards_.size(); ++ i)
+    {
+        ret = shards_[i]->send(TxFrame(frame)) && ret;
+    }
+
+    return shards_[0]->send(std::move(frame)) && ret;
 }
 
     /**
@@ -849,6 +2512,72 @@ bool TcpServer::send(DataFrame const &frame)
     return send(frame.get_host(), frame.data_pointer(), frame.size());    
 }
 
+/**
+ * @brief 发送一帧并接管它的数据
+ * 
+ * @param frame 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::send(DataFrame &&frame)
+{
+    TxFrame tx;
+    tx.host = frame.get_host();
+    tx.payload = SharedPayload::adopt(std::move(frame));
+
+    if (tx.payload.empty())
+    {
+        return false;
+    }
+
+    return send_frame(std::move(tx));
+}
+
+/**
+ * @brief 发送数据并接管vector的内存
+ * 
+ * @param host 
+ * @param data 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::send(Host const & host, std::vector<uint8_t> &&data)
+{
+    TxFrame tx;
+    tx.host = host;
+    tx.payload = SharedPayload::adopt(std::move(data));
+
+    if (tx.payload.empty())
+    {
+        return false;
+    }
+
+    return send_frame(std::move(tx));
+}
+
+/**
+ * @brief 发送数据并接管new[]分配的内存
+ * 
+ * @param host 
+ * @param data 
+ * @param size 
+ * @return true 
+ * @return false 
+ */
+bool TcpServer::send(Host const & host, std::unique_ptr<uint8_t []> data, int size)
+{
+    TxFrame tx;
+    tx.host = host;
+    tx.payload = SharedPayload::adopt(std::move(data), size);
+
+    if (tx.payload.empty())
+    {
+        return false;
+    }
+
+    return send_frame(std::move(tx));
+}
+
 // /**
 //  * @brief 对队列中接收一帧数据
 //  * 
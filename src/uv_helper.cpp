@@ -179,8 +179,24 @@ TcpServer::TcpServer(Loop::Type type)
     });
 }
 
+/**
+ * @brief 使用一个外部的loop
+ * 
+ * @param loop 
+ */
+TcpServer::TcpServer(uv_loop_t *loop) : loop_(loop), own_loop_(false)
+{
+
+}
+
 TcpServer::~TcpServer()
 {
+    // 外部loop由使用者关闭
+    if (!own_loop_)
+    {
+        return ;
+    }
+
     uv_loop_close(loop_);
 
     // 关闭loop
@@ -229,6 +245,11 @@ bool TcpServer::listen(int backlog, uv_connection_cb callback)
 
 void TcpServer::async_stop()
 {
+    if (!own_loop_)
+    {
+        return ;
+    }
+
     uv_async_send(&async_stop_);
 }
 
@@ -0,0 +1,401 @@
+/**
+ * @file bench_serial.cpp
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 使用openpty()测试串口收发路径的吞吐量、延时和丢包
+ * @version 0.1
+ * @date 2023-06-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   不需要真实串口，在任意Linux机器上都可以运行:
+ *     bench_serial [每项测试的字节数] [接收队列大小] [允许的丢失比例%]
+ *   测试项:
+ *     - sync   调用read()同步读取
+ *     - async  接收线程 + loop通知，async_read()读取
+ *     - poll   在loop中直接读取(async_poll_start)
+ *   延时为数据写入pty到被使用者读出的时间，CPU为整个进程(含写入线程)的用户态+内核态时间
+ *   任一项的丢失比例超过允许值(默认0)或数据内容错误时，返回非0，可以在CI中检查性能回退
+ */
+#include <pty.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <common/logger.h>
+#include <common/sys_time.h>
+#include <common/uv_helper.h>
+#include <common/serial_port.h>
+
+#define APP_NAME  "bench-serial"
+
+/// 读取端没有新数据超过这个时间(us)，认为剩余数据已丢失
+#define BENCH_STALL_US   500000
+
+/// 接收模式
+enum class Mode : int
+{
+    Sync = 0,
+    Async,
+    Poll,
+};
+
+static const char *mode_name(Mode mode)
+{
+    switch (mode)
+    {
+        case Mode::Sync:
+            return "sync";
+        case Mode::Async:
+            return "async";
+        default:
+            return "poll";
+    }
+}
+
+/**
+ * @brief 一项测试
+ *
+ */
+class BenchCase
+{
+public:
+    BenchCase(int master, std::size_t total, int chunk) :
+        master_(master), total_(total), chunk_(chunk)
+    {
+        std::size_t chunks = (total + chunk - 1) / chunk;
+        ends_.resize(chunks);
+        times_.resize(chunks);
+        latency_.reserve(chunks);
+
+        // 数据内容为 偏移 & 0xff，多留256字节，写入时按偏移取起始位置
+        pattern_.resize(chunk + 256);
+        for (std::size_t i = 0; i < pattern_.size(); ++ i)
+        {
+            pattern_[i] = static_cast<uint8_t>(i);
+        }
+    }
+
+    /// 写入线程
+    void writer()
+    {
+        std::size_t offset = 0;
+        std::size_t index = 0;
+
+        while (offset < total_)
+        {
+            std::size_t size = std::min<std::size_t>(chunk_, total_ - offset);
+
+            // 先记录时间戳，保证读取端看到数据时一定能找到时间戳
+            ends_[index] = offset + size;
+            times_[index] = naiad::system::uptime_us();
+            stamped_.store(index + 1, std::memory_order_release);
+
+            uint8_t const *data = pattern_.data() + (offset & 0xff);
+            std::size_t done = 0;
+            while (done < size)
+            {
+                int ret = ::write(master_, data + done, size - done);
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    slog::error("write pty failed: {}", strerror(errno));
+                    return ;
+                }
+                done += ret;
+            }
+
+            offset += size;
+            index ++;
+        }
+    }
+
+    /// 读取端收到数据
+    void input(uint8_t const *data, int size)
+    {
+        for (int i = 0; i < size; ++ i)
+        {
+            if (data[i] != static_cast<uint8_t>(received_ + i))
+            {
+                corrupt_ ++;
+            }
+        }
+
+        received_ += size;
+        last_rx_us_ = naiad::system::uptime_us();
+
+        std::size_t stamped = stamped_.load(std::memory_order_acquire);
+        while ((next_ < stamped) && (ends_[next_] <= received_))
+        {
+            latency_.push_back(last_rx_us_ - times_[next_]);
+            next_ ++;
+        }
+    }
+
+    /// 是否结束
+    bool finished(int64_t now_us) const
+    {
+        return (received_ >= total_) || (now_us - last_rx_us_ > BENCH_STALL_US);
+    }
+
+    void start()
+    {
+        start_us_ = naiad::system::uptime_us();
+        last_rx_us_ = start_us_;
+    }
+
+    /**
+     * @brief 输出结果
+     *
+     * @param mode
+     * @param stats
+     * @param cpu_us
+     * @param max_drop 允许的丢失比例(%)
+     * @return true
+     * @return false 丢失超过允许值，或数据内容错误
+     */
+    bool report(Mode mode, naiad::driver::SerialStatistics const &stats, double cpu_us, double max_drop)
+    {
+        std::sort(latency_.begin(), latency_.end());
+
+        auto percentile = [this](double p) -> int64_t {
+            if (latency_.empty())
+            {
+                return 0;
+            }
+            std::size_t index = static_cast<std::size_t>(p * (latency_.size() - 1));
+            return latency_[index];
+        };
+
+        double seconds = (last_rx_us_ - start_us_) / 1e6;
+        double mbytes = received_ / (1024.0 * 1024.0);
+        double drop = 100.0 * (total_ - std::min(received_, total_)) / total_;
+
+        // 有丢弃时数据已错位，不再检查内容
+        std::size_t corrupt = (stats.rx_drop_bytes == 0) ? corrupt_ : 0;
+        bool passed = (drop <= max_drop) && (corrupt == 0);
+
+        slog::info("{:<5} chunk {:>5}: {:>8.2f} MB/s, latency p50 {:>6}us p99 {:>6}us p999 {:>6}us, "
+            "cpu {:>8.0f}us/MB, drop {:.3f}% ({} bytes), corrupt {}",
+            mode_name(mode), chunk_,
+            (seconds > 0) ? (mbytes / seconds) : 0.0,
+            percentile(0.50), percentile(0.99), percentile(0.999),
+            (mbytes > 0) ? (cpu_us / mbytes) : 0.0,
+            drop, stats.rx_drop_bytes, corrupt);
+
+        if (!passed)
+        {
+            slog::error("{:<5} chunk {:>5}: FAILED, drop {:.3f}% (max {}%), corrupt {}", mode_name(mode), chunk_, drop, max_drop, corrupt);
+        }
+
+        return passed;
+    }
+
+private:
+    int master_;
+    std::size_t total_;
+    int chunk_;
+    std::vector<uint8_t> pattern_;
+
+    /// 每块数据的结束位置和写入时间
+    std::vector<std::size_t> ends_;
+    std::vector<int64_t> times_;
+    std::atomic<std::size_t> stamped_ {0};
+
+    /// 以下只由读取端访问
+    std::size_t received_ = 0;
+    std::size_t next_ = 0;
+    std::size_t corrupt_ = 0;
+    std::vector<int64_t> latency_;
+    int64_t start_us_ = 0;
+    int64_t last_rx_us_ = 0;
+};
+
+/// 返回进程使用的CPU时间(us)
+static double cpu_time_us()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec * 1e6 + usage.ru_utime.tv_usec
+        + usage.ru_stime.tv_sec * 1e6 + usage.ru_stime.tv_usec;
+}
+
+/**
+ * @brief 运行一项测试
+ *
+ * @param loop
+ * @param mode
+ * @param total
+ * @param chunk
+ * @param queue_size
+ * @param max_drop 允许的丢失比例(%)
+ * @param passed 返回丢失和数据内容是否符合要求
+ * @return true
+ * @return false 测试无法运行
+ */
+static bool run_case(uv::Loop &loop, Mode mode, std::size_t total, int chunk, int queue_size, double max_drop, bool &passed)
+{
+    int master, slave;
+    char name[64];
+
+    if (openpty(&master, &slave, name, nullptr, nullptr) < 0)
+    {
+        slog::error("openpty() failed: {}", strerror(errno));
+        return false;
+    }
+
+    naiad::driver::SerialPort port(name);
+
+    if (!port.open("115200"))
+    {
+        ::close(master);
+        ::close(slave);
+        return false;
+    }
+
+    BenchCase bench(master, total, chunk);
+    std::vector<uint8_t> buf(65536);
+
+    auto drain = [&port, &bench, &buf]() {
+        int size;
+        while ((size = port.async_read(buf.data(), static_cast<int>(buf.size()))) > 0)
+        {
+            bench.input(buf.data(), size);
+        }
+    };
+
+    bool started = true;
+    if (mode == Mode::Async)
+    {
+        started = port.async_read_start(loop, [&drain](int) { drain(); }, queue_size);
+    }
+    else if (mode == Mode::Poll)
+    {
+        started = port.async_poll_start(loop, [&drain](int) { drain(); }, queue_size);
+    }
+
+    if (!started)
+    {
+        port.close();
+        ::close(master);
+        ::close(slave);
+        return false;
+    }
+
+    // 定时检查是否结束，同时保证run(Once)能返回
+    uv::Timer timer;
+    timer.bind(loop);
+    timer.start(10, 10, []() { });
+
+    double cpu_start = cpu_time_us();
+    bench.start();
+
+    std::thread writer(&BenchCase::writer, &bench);
+
+    while (!bench.finished(naiad::system::uptime_us()))
+    {
+        if (mode == Mode::Sync)
+        {
+            int size = port.read(buf.data(), static_cast<int>(buf.size()), 10);
+            if (size > 0)
+            {
+                bench.input(buf.data(), size);
+            }
+        }
+        else
+        {
+            loop.run(uv::Loop::RunMode::Once);
+        }
+    }
+
+    double cpu_used = cpu_time_us() - cpu_start;
+
+    // 读取端结束后写入端可能阻塞，先关闭slave端使其退出
+    port.close();
+    ::close(slave);
+    writer.join();
+    ::close(master);
+
+    timer.close();
+    loop.run(uv::Loop::RunMode::NoWait);
+
+    passed = bench.report(mode, port.get_statistics(), cpu_used, max_drop);
+
+    return true;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    slog::make_stdout_logger(APP_NAME, slog::LogLevel::Info);
+
+    std::size_t total = 4 * 1024 * 1024;
+    int queue_size = 65536;
+    double max_drop = 0.0;
+
+    if (argc > 1)
+    {
+        total = strtoul(argv[1], nullptr, 10);
+    }
+
+    if (argc > 2)
+    {
+        queue_size = static_cast<int>(strtoul(argv[2], nullptr, 10));
+    }
+
+    if (argc > 3)
+    {
+        max_drop = strtod(argv[3], nullptr);
+    }
+
+    if ((total == 0) || (queue_size <= 0) || (max_drop < 0))
+    {
+        slog::error("usage: {} [bytes-per-case] [queue-size] [max-drop-percent]", argv[0]);
+        return 1;
+    }
+
+    slog::info(APP_NAME " started, {} bytes per case, queue size {}, max drop {}%", total, queue_size, max_drop);
+
+    uv::Loop loop(uv::Loop::Type::New);
+
+    int const chunks[] = { 16, 64, 256, 1024, 4096 };
+    Mode const modes[] = { Mode::Sync, Mode::Async, Mode::Poll };
+
+    int failed = 0;
+
+    for (auto mode : modes)
+    {
+        for (auto chunk : chunks)
+        {
+            bool passed = false;
+            if (!run_case(loop, mode, total, chunk, queue_size, max_drop, passed))
+            {
+                return 1;
+            }
+
+            if (!passed)
+            {
+                failed ++;
+            }
+        }
+    }
+
+    if (failed > 0)
+    {
+        slog::error("{} cases dropped or corrupted data", failed);
+        return 1;
+    }
+
+    slog::info("all cases passed");
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+/**
+ * @file test_data_frame.cpp
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 统计DataFrame的堆分配次数，检查小数据帧不使用堆内存
+ * @version 0.1
+ * @date 2023-07-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   替换全局的operator new/delete，只在检查期间计数
+ */
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include <common/logger.h>
+#include <common/network_frame.h>
+
+#define APP_NAME  "test-data-frame"
+
+using naiad::network::Host;
+using naiad::network::DataFrame;
+using naiad::network::BufferPool;
+using naiad::network::SharedBuffer;
+
+/// 堆分配次数
+static std::atomic<int> g_allocs {0};
+
+void * operator new(std::size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+
+    void *p = std::malloc(size ? size : 1);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void * operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static int g_failed = 0;
+
+/**
+ * @brief 检查一项结果
+ *
+ * @param name
+ * @param ok
+ */
+static void check(char const *name, bool ok)
+{
+    if (ok)
+    {
+        slog::info("{:<32} ok", name);
+    }
+    else
+    {
+        slog::error("{:<32} FAILED", name);
+        g_failed ++;
+    }
+}
+
+/// 检查帧数据是否为 (seed + i)
+static bool verify(DataFrame const &frame, int size, int seed)
+{
+    if ((frame.size() != size) || (frame.data_pointer() == nullptr))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < size; ++ i)
+    {
+        if (frame.data_pointer()[i] != static_cast<uint8_t>(seed + i))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief 按size做一组构造、复制、移动，返回期间的堆分配次数
+ *
+ * @param size
+ * @return int
+ */
+static int exercise(int size)
+{
+    uint8_t data[1024];
+    for (int i = 0; i < size; ++ i)
+    {
+        data[i] = static_cast<uint8_t>(i);
+    }
+
+    Host host = {"127.0.0.1", 9000, 1};
+    bool ok = true;
+
+    int start = g_allocs.load();
+    {
+        DataFrame a(host, data, size);
+        ok = ok && verify(a, size, 0);
+
+        DataFrame b(a);
+        ok = ok && verify(b, size, 0);
+
+        DataFrame c(std::move(a));
+        ok = ok && verify(c, size, 0) && a.is_empty();
+
+        DataFrame d(0);
+        d = b;
+        ok = ok && verify(d, size, 0);
+
+        DataFrame e(0);
+        e = std::move(c);
+        ok = ok && verify(e, size, 0) && c.is_empty();
+
+        DataFrame f(host, size);
+        ok = ok && (f.size() == size);
+        for (int i = 0; i < size; ++ i)
+        {
+            ok = ok && (f[i] == 0);
+        }
+    }
+    int allocs = g_allocs.load() - start;
+
+    check(size <= DataFrame::InlineSize ? "small frame data" : "large frame data", ok);
+
+    return allocs;
+}
+
+int main()
+{
+    slog::make_stdout_logger(APP_NAME, slog::LogLevel::Info);
+
+    // 小数据帧: 构造、复制、移动都不分配
+    for (int size : {1, 8, 32, DataFrame::InlineSize})
+    {
+        int allocs = exercise(size);
+        slog::info("size {:>4}: {} allocations", size, allocs);
+        check("small frame no heap", allocs == 0);
+    }
+
+    // 大数据帧: 数据构造、复制构造、复制赋值、清零构造各一次，移动不分配
+    for (int size : {DataFrame::InlineSize + 1, 1024})
+    {
+        int allocs = exercise(size);
+        slog::info("size {:>4}: {} allocations", size, allocs);
+        check("large frame one per copy", allocs == 4);
+    }
+
+    // 接管共享缓存: 不复制数据
+    {
+        auto pool = BufferPool::create(4096, 2);
+        uint8_t *block = pool->allocate();
+        for (int i = 0; i < 100; ++ i)
+        {
+            block[10 + i] = static_cast<uint8_t>(i);
+        }
+
+        Host host = {"127.0.0.1", 9000, 1};
+
+        int start = g_allocs.load();
+        bool ok;
+        {
+            DataFrame a(host, SharedBuffer::adopt(block), 100, 10);
+            DataFrame b(std::move(a));
+            ok = verify(b, 100, 0) && (b.data_pointer() == block + 10) && a.is_empty();
+        }
+        int allocs = g_allocs.load() - start;
+
+        check("shared buffer frame data", ok);
+        check("shared buffer frame no heap", allocs == 0);
+    }
+
+    // 发送时接管数据: 堆上和共享缓存中的数据不复制
+    {
+        uint8_t data[1024] = {0};
+        Host host = {"127.0.0.1", 9000, 1};
+        bool ok = true;
+
+        DataFrame large(host, data, sizeof(data));
+        uint8_t const *pointer = large.data_pointer();
+        auto payload = naiad::network::SharedPayload::adopt(std::move(large));
+        ok = ok && (payload.data() == pointer) && (payload.size() == 1024) && large.is_empty();
+
+        DataFrame small(host, data, 16);
+        payload = naiad::network::SharedPayload::adopt(std::move(small));
+        ok = ok && (payload.size() == 16) && small.is_empty();
+
+        std::vector<uint8_t> vector(100 * 1024);
+        pointer = vector.data();
+        payload = naiad::network::SharedPayload::adopt(std::move(vector));
+        ok = ok && (payload.data() == pointer) && (payload.size() == 100 * 1024);
+
+        check("adopt payload without copy", ok);
+    }
+
+    if (g_failed > 0)
+    {
+        slog::error("{} checks failed", g_failed);
+        return 1;
+    }
+
+    slog::info("all checks passed");
+
+    return 0;
+}
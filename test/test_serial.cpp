@@ -75,6 +75,10 @@ int main(int argc, const char *argv[])
                 slog::info("fifo: {} peak {}", stats.fifo_size, stats.fifo_peak_size);
                 slog::info("tx  : {} ", stats.tx_bytes);
                 slog::info("rx  : {} drop {}", stats.rx_bytes, stats.rx_drop_bytes);
+                slog::info("rx chunk p50 {} p99 {}, latency p50 {}us p99 {}us, fifo p99 {}", 
+                    stats.rx_chunk_sizes.percentile(50), stats.rx_chunk_sizes.percentile(99),
+                    stats.rx_latency_us.percentile(50), stats.rx_latency_us.percentile(99),
+                    stats.fifo_usage.percentile(99));
 
                 //port->async_read_stop();                
             });
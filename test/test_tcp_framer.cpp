@@ -0,0 +1,408 @@
+/**
+ * @file test_tcp_framer.cpp
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 在回环地址上检查TcpServer按长度字段分帧
+ * @version 0.1
+ * @date 2023-07-11
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   - 消息按随机大小分段写入，检查跨多次读取的拼接
+ *   - 回调模式中消息不被引用，未完成的部分在缓存中原地移动；
+ *     队列模式中消息还被引用，未完成的部分复制到新的缓存
+ *   - 小端长度字段、长度偏移和长度修正
+ *   - 长度非法时断开连接，max_size不能超过接收缓存的块大小
+ */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <vector>
+#include <random>
+#include <atomic>
+#include <algorithm>
+
+#include <common/logger.h>
+#include <common/tcp_server.h>
+
+#define APP_NAME  "test-tcp-framer"
+
+/// 测试使用的起始端口
+#define TEST_PORT        19820
+
+/// 接收缓存的块大小和数量，块较小时更容易走到移动和复制的路径
+#define TEST_BLOCK_SIZE  4096
+#define TEST_BLOCK_NUM   4
+
+/// 最大消息长度
+#define TEST_MAX_SIZE    1024
+
+using naiad::network::Host;
+using naiad::network::DataFrame;
+using naiad::network::TcpServer;
+using naiad::network::TcpFramerConfig;
+
+static int g_failed = 0;
+
+/**
+ * @brief 检查一项结果
+ *
+ * @param name
+ * @param ok
+ */
+static void check(char const *name, bool ok)
+{
+    if (ok)
+    {
+        slog::info("{:<40} ok", name);
+    }
+    else
+    {
+        slog::error("{:<40} FAILED", name);
+        g_failed ++;
+    }
+}
+
+/// 连接到本机端口
+static int connect_to(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in addr = { };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/// 写入全部数据
+static bool write_all(int fd, uint8_t const *data, std::size_t size)
+{
+    while (size > 0)
+    {
+        int ret = ::write(fd, data, size);
+        if (ret <= 0)
+        {
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+
+    return true;
+}
+
+/// 等待条件成立，最多约2秒
+template <typename Cond>
+static bool wait_for(Cond cond)
+{
+    for (int i = 0; i < 200; ++ i)
+    {
+        if (cond())
+        {
+            return true;
+        }
+        usleep(10000);
+    }
+
+    return cond();
+}
+
+/**
+ * @brief 测试使用的消息格式
+ *
+ * @note [类型 1字节][长度字段][负载]，类型为序号，负载内容为 序号 + 偏移
+ */
+class MessageStream
+{
+public:
+    MessageStream(TcpFramerConfig const &config, int num, unsigned seed) : config_(config)
+    {
+        std::mt19937 random(seed);
+        int header = config_.length_offset + config_.length_size;
+
+        for (int i = 0; i < num; ++ i)
+        {
+            int total = header + static_cast<int>(random() % (TEST_MAX_SIZE - header + 1));
+            int length = total - config_.length_adjust;
+
+            sizes_.push_back(total);
+
+            std::size_t start = data_.size();
+            data_.resize(start + total);
+            uint8_t *p = data_.data() + start;
+
+            p[0] = static_cast<uint8_t>(i);
+            for (int k = 0; k < config_.length_size; ++ k)
+            {
+                int shift = 8 * (config_.big_endian ? (config_.length_size - 1 - k) : k);
+                p[config_.length_offset + k] = static_cast<uint8_t>(length >> shift);
+            }
+
+            for (int k = header; k < total; ++ k)
+            {
+                p[k] = static_cast<uint8_t>(i + k);
+            }
+        }
+    }
+
+    /// 按随机大小分段写入
+    bool write(int fd, unsigned seed) const
+    {
+        std::mt19937 random(seed);
+        std::size_t offset = 0;
+
+        while (offset < data_.size())
+        {
+            std::size_t size = std::min<std::size_t>(1 + random() % 3000, data_.size() - offset);
+            if (!write_all(fd, data_.data() + offset, size))
+            {
+                return false;
+            }
+            offset += size;
+        }
+
+        return true;
+    }
+
+    /// 检查收到的第index条消息
+    bool verify(int index, void const *data, std::size_t size) const
+    {
+        if ((index >= static_cast<int>(sizes_.size())) || (size != static_cast<std::size_t>(sizes_[index])))
+        {
+            return false;
+        }
+
+        uint8_t const *p = static_cast<uint8_t const *>(data);
+        int header = config_.length_offset + config_.length_size;
+
+        if (p[0] != static_cast<uint8_t>(index))
+        {
+            return false;
+        }
+
+        for (int k = header; k < sizes_[index]; ++ k)
+        {
+            if (p[k] != static_cast<uint8_t>(index + k))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int num() const
+    {
+        return static_cast<int>(sizes_.size());
+    }
+
+private:
+    TcpFramerConfig config_;
+    std::vector<uint8_t> data_;
+    std::vector<int> sizes_;
+};
+
+/**
+ * @brief 回调模式，消息在回调返回后不再引用，未完成的部分原地移动
+ *
+ * @param config
+ * @param name
+ * @param port
+ */
+static void test_callback(TcpFramerConfig const &config, char const *name, int port)
+{
+    TcpServer tcp("test", "127.0.0.1", port, 0);
+    tcp.set_read_buffers(TEST_BLOCK_SIZE, TEST_BLOCK_NUM);
+    tcp.set_framer(config);
+
+    MessageStream stream(config, 2000, port);
+    std::atomic<int> received {0};
+    std::atomic<int> bad {0};
+
+    bool started = tcp.start([&](Host const &, void const * const data, std::size_t size) {
+            if (!stream.verify(received ++, data, size))
+            {
+                bad ++;
+            }
+        });
+
+    int fd = started ? connect_to(port) : -1;
+    bool ok = (fd >= 0) && stream.write(fd, port + 1);
+
+    ok = ok && wait_for([&]() { return received == stream.num(); });
+    slog::info("{}: received {} of {} messages, {} bad", name, received.load(), stream.num(), bad.load());
+    check(name, ok && (bad == 0));
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    tcp.stop();
+}
+
+/**
+ * @brief 队列模式，消息在取出前一直引用接收缓存，未完成的部分需要复制到新的缓存
+ *
+ * @param config
+ * @param name
+ * @param port
+ */
+static void test_queue(TcpFramerConfig const &config, char const *name, int port)
+{
+    TcpServer tcp("test", "127.0.0.1", port, 0);
+    tcp.set_read_buffers(TEST_BLOCK_SIZE, TEST_BLOCK_NUM);
+    tcp.set_framer(config);
+
+    MessageStream stream(config, 2000, port);
+
+    int fd = tcp.start() ? connect_to(port) : -1;
+    bool ok = (fd >= 0) && stream.write(fd, port + 1);
+
+    // 全部到达后再取出，取出前所有消息都持有缓存的引用
+    ok = ok && wait_for([&]() { return tcp.received_frames_num() == stream.num(); });
+
+    int received = 0;
+    int bad = 0;
+    std::vector<DataFrame> frames;
+
+    while (tcp.receive_batch(frames) > 0)
+    {
+        for (auto const &frame : frames)
+        {
+            if (!stream.verify(received ++, frame.data_pointer(), frame.size()))
+            {
+                bad ++;
+            }
+        }
+    }
+
+    auto stats = tcp.get_read_buffer_statistics();
+    slog::info("{}: received {} of {} messages, {} bad, buffer hits {}, misses {}", name, received, stream.num(), bad, stats.hits, stats.misses);
+    check(name, ok && (received == stream.num()) && (bad == 0));
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    tcp.stop();
+}
+
+/// 按小端写入消息的总长度，格式同total_le
+static void set_length(uint8_t *message, int length)
+{
+    message[1] = static_cast<uint8_t>(length);
+    message[2] = static_cast<uint8_t>(length >> 8);
+}
+
+/**
+ * @brief 长度非法时断开连接，之前的消息仍然送达
+ *
+ * @param config 长度为小端的总长度
+ * @param port
+ */
+static void test_invalid_length(TcpFramerConfig const &config, int port)
+{
+    TcpServer tcp("test", "127.0.0.1", port, 0);
+    tcp.set_read_buffers(TEST_BLOCK_SIZE, TEST_BLOCK_NUM);
+    tcp.set_framer(config);
+
+    std::atomic<int> received {0};
+    std::vector<std::size_t> sizes;
+
+    bool started = tcp.start([&](Host const &, void const * const, std::size_t size) {
+            sizes.push_back(size);
+            received ++;
+        });
+
+    int fd = started ? connect_to(port) : -1;
+    bool ok = (fd >= 0) && wait_for([&]() { return tcp.connections_num() == 1; });
+
+    // 最大长度的消息可以收到，超过最大长度时断开
+    std::vector<uint8_t> data(TEST_MAX_SIZE, 0);
+    set_length(data.data(), TEST_MAX_SIZE);
+    ok = ok && write_all(fd, data.data(), data.size());
+    ok = ok && wait_for([&]() { return received == 1; });
+    check("max size message received", ok && (sizes.size() == 1) && (sizes[0] == TEST_MAX_SIZE));
+
+    set_length(data.data(), TEST_MAX_SIZE + 1);
+    ok = ok && write_all(fd, data.data(), 3);
+    check("too long message disconnected", ok && wait_for([&]() { return tcp.connections_num() == 0; }) && (received == 1));
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    // 长度小于头部时也断开
+    fd = connect_to(port);
+    ok = (fd >= 0) && wait_for([&]() { return tcp.connections_num() == 1; });
+
+    uint8_t header[3] = { 0, 0, 0 };
+    set_length(header, 2);
+    ok = ok && write_all(fd, header, sizeof(header));
+    check("too short message disconnected", ok && wait_for([&]() { return tcp.connections_num() == 0; }));
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    tcp.stop();
+}
+
+int main()
+{
+    slog::make_stdout_logger(APP_NAME, slog::LogLevel::Info);
+
+    // [类型][负载长度 大端]，长度只包含负载
+    TcpFramerConfig const payload_be = { 1, 2, true, 3, TEST_MAX_SIZE };
+    // [类型][总长度 小端]
+    TcpFramerConfig const total_le = { 1, 2, false, 0, TEST_MAX_SIZE };
+
+    int port = TEST_PORT;
+
+    {
+        TcpServer tcp("test", "127.0.0.1", port, 0);
+        TcpFramerConfig bad = payload_be;
+        bad.length_size = 3;
+        check("reject 3 bytes length field", !tcp.set_framer(bad));
+
+        tcp.set_read_buffers(TEST_BLOCK_SIZE, TEST_BLOCK_NUM);
+        bad = payload_be;
+        bad.max_size = TEST_BLOCK_SIZE + 1;
+        tcp.set_framer(bad);
+        check("reject max size over block size", !tcp.start());
+    }
+
+    test_callback(payload_be, "callback, payload length big endian", ++ port);
+    test_callback(total_le, "callback, total length little endian", ++ port);
+    test_queue(payload_be, "queue, payload length big endian", ++ port);
+    test_queue(total_le, "queue, total length little endian", ++ port);
+    test_invalid_length(total_le, ++ port);
+
+    if (g_failed > 0)
+    {
+        slog::error("{} checks failed", g_failed);
+        return 1;
+    }
+
+    slog::info("all checks passed");
+
+    return 0;
+}
@@ -109,8 +109,8 @@ private:
 
         while(main_running_)
         {        
-            // 从串口接收到数据
-            int size = serial_.async_read(buf, sizeof(buf));    
+            // 从串口接收到数据，没有数据时休眠，最多10ms后检查一次TCP数据
+            int size = serial_.async_read_wait(buf, sizeof(buf), 1, 10);    
             if (size > 0)
             {
                 tcp_.send(tcp_.AllClients, buf, size);                
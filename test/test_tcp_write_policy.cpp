@@ -0,0 +1,305 @@
+/**
+ * @file test_tcp_write_policy.cpp
+ * @author Liu Chuansen (samule@neptune-robotics.com)
+ * @brief 在回环地址上检查TcpServer各个发送拥塞策略
+ * @version 0.1
+ * @date 2023-07-11
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @note
+ *   - 空闲连接上发送超过高水位的单帧，不能进入拥塞，之后的帧也要正常送达
+ *   - 客户端停止读取时，各策略的丢弃、缓存、断开和阻塞行为
+ */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+#include <common/logger.h>
+#include <common/tcp_server.h>
+
+#define APP_NAME  "test-tcp-write-policy"
+
+/// 测试使用的起始端口
+#define TEST_PORT        19800
+
+using naiad::network::TcpServer;
+
+static int g_failed = 0;
+
+/**
+ * @brief 检查一项结果
+ *
+ * @param policy
+ * @param name
+ * @param ok
+ */
+static void check(char const *policy, char const *name, bool ok)
+{
+    if (ok)
+    {
+        slog::info("{:<12} {:<36} ok", policy, name);
+    }
+    else
+    {
+        slog::error("{:<12} {:<36} FAILED", policy, name);
+        g_failed ++;
+    }
+}
+
+/// 连接到本机端口，读取超时为timeout_ms
+static int connect_to(int port, int timeout_ms)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in addr = { };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    return fd;
+}
+
+/// 读取size字节，超时或连接断开时返回已读取的字节数
+static std::size_t read_all(int fd, uint8_t *buf, std::size_t size)
+{
+    std::size_t got = 0;
+
+    while (got < size)
+    {
+        int ret = ::read(fd, buf + got, size - got);
+        if (ret <= 0)
+        {
+            break;
+        }
+        got += ret;
+    }
+
+    return got;
+}
+
+/// 等待连接数量变为num
+static bool wait_connections(TcpServer &tcp, int num)
+{
+    for (int i = 0; i < 100; ++ i)
+    {
+        if (tcp.connections_num() == num)
+        {
+            return true;
+        }
+        usleep(10000);
+    }
+
+    return false;
+}
+
+/**
+ * @brief 空闲连接上发送超过高水位的单帧
+ *
+ * @param policy
+ * @param name
+ * @param port
+ */
+static void test_idle_large_frame(TcpServer::WritePolicy policy, char const *name, int port)
+{
+    TcpServer tcp("test", "127.0.0.1", port, 0);
+    tcp.set_write_watermarks(1024, 256, policy);
+
+    if (!tcp.start())
+    {
+        check(name, "start", false);
+        return ;
+    }
+
+    int fd = connect_to(port, 1000);
+    bool connected = (fd >= 0) && wait_connections(tcp, 1);
+    check(name, "connect", connected);
+
+    if (connected)
+    {
+        // 2000字节的大帧，随后一个小帧，再重复发送大帧
+        std::vector<uint8_t> data(2000);
+        for (std::size_t i = 0; i < data.size(); ++ i)
+        {
+            data[i] = static_cast<uint8_t>(i);
+        }
+
+        std::size_t total = 0;
+        tcp.send(TcpServer::AllClients, data.data(), 2000);
+        total += 2000;
+        tcp.send(TcpServer::AllClients, data.data(), 10);
+        total += 10;
+
+        std::vector<uint8_t> buf(total);
+        bool ok = (read_all(fd, buf.data(), total) == total);
+        ok = ok && std::equal(data.begin(), data.begin() + 2000, buf.begin())
+            && std::equal(data.begin(), data.begin() + 10, buf.begin() + 2000);
+        check(name, "idle large frame delivered", ok);
+
+        for (int i = 0; i < 20; ++ i)
+        {
+            tcp.send(TcpServer::AllClients, data.data(), 2000);
+            ok = ok && (read_all(fd, buf.data(), 2000) == 2000);
+        }
+        check(name, "later large frames delivered", ok);
+
+        auto stats = tcp.get_write_statistics();
+        check(name, "idle connection not congested",
+            (stats.congested == 0) && (stats.dropped_newest == 0) && (stats.dropped_oldest == 0) && (stats.disconnected == 0));
+        check(name, "connection kept", tcp.connections_num() == 1);
+    }
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    tcp.stop();
+}
+
+/**
+ * @brief 客户端暂停读取，发送大量数据使连接拥塞，之后恢复读取
+ *
+ * @param policy
+ * @param name
+ * @param port
+ */
+static void test_slow_client(TcpServer::WritePolicy policy, char const *name, int port)
+{
+    TcpServer tcp("test", "127.0.0.1", port, 0);
+    tcp.set_write_watermarks(64 * 1024, 16 * 1024, policy);
+
+    if (!tcp.start())
+    {
+        check(name, "start", false);
+        return ;
+    }
+
+    int fd = connect_to(port, 500);
+    bool connected = (fd >= 0) && wait_connections(tcp, 1);
+    check(name, "connect", connected);
+
+    if (connected)
+    {
+        int const frames = 4000;
+        int const frame_size = 4096;
+        std::vector<uint8_t> data(frame_size, 0x5a);
+
+        // Block策略时发送者会等待，在另一个线程中发送
+        std::atomic<bool> sent {false};
+        std::thread sender([&]() {
+                for (int i = 0; i < frames; ++ i)
+                {
+                    tcp.send(TcpServer::AllClients, data.data(), frame_size);
+                }
+                sent = true;
+            });
+
+        // 先不读取，等待连接拥塞
+        usleep(300000);
+
+        std::vector<uint8_t> buf(64 * 1024);
+        std::size_t received = 0;
+        std::size_t got;
+        while ((got = read_all(fd, buf.data(), buf.size())) > 0)
+        {
+            received += got;
+            if (sent && (received >= static_cast<std::size_t>(frames) * frame_size))
+            {
+                break;
+            }
+        }
+
+        sender.join();
+
+        std::size_t total = static_cast<std::size_t>(frames) * frame_size;
+        auto stats = tcp.get_write_statistics();
+
+        slog::info("{:<12} received {} of {} bytes, congested {}, blocked {}, dropped newest {}, oldest {}, disconnected {}",
+            name, received, total, stats.congested, stats.blocked, stats.dropped_newest, stats.dropped_oldest, stats.disconnected);
+
+        check(name, "congested", stats.congested > 0);
+
+        switch (policy)
+        {
+            case TcpServer::WritePolicy::Block:
+                check(name, "all data received", received == total);
+                check(name, "sender blocked", stats.blocked > 0);
+                break;
+
+            case TcpServer::WritePolicy::DropNewest:
+                check(name, "newest frames dropped", (stats.dropped_newest > 0) && (received < total));
+                check(name, "received whole frames", (received % frame_size) == 0);
+                break;
+
+            case TcpServer::WritePolicy::DropOldest:
+                check(name, "oldest frames dropped", (stats.dropped_oldest > 0) && (received < total));
+                check(name, "received whole frames", (received % frame_size) == 0);
+                break;
+
+            default:
+                check(name, "slow connection closed", (stats.disconnected == 1) && wait_connections(tcp, 0));
+                break;
+        }
+    }
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    tcp.stop();
+}
+
+int main()
+{
+    slog::make_stdout_logger(APP_NAME, slog::LogLevel::Info);
+
+    struct
+    {
+        TcpServer::WritePolicy policy;
+        char const *name;
+    } const policies[] = {
+        { TcpServer::WritePolicy::Block,        "block" },
+        { TcpServer::WritePolicy::DropNewest,   "drop-newest" },
+        { TcpServer::WritePolicy::DropOldest,   "drop-oldest" },
+        { TcpServer::WritePolicy::Disconnect,   "disconnect" },
+    };
+
+    int port = TEST_PORT;
+
+    for (auto const &it : policies)
+    {
+        test_idle_large_frame(it.policy, it.name, port ++);
+        test_slow_client(it.policy, it.name, port ++);
+    }
+
+    if (g_failed > 0)
+    {
+        slog::error("{} checks failed", g_failed);
+        return 1;
+    }
+
+    slog::info("all checks passed");
+
+    return 0;
+}